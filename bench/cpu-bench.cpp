@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "cpu.h"
+#include "mem.h"
+#ifdef BOYC_JIT
+#include "cpu_jit.h"
+#endif
+
+/**
+ * Micro benchmark for the cpu core.
+ * Runs a small synthetic loop (ALU, loads/stores, CB ops, branches) and
+ * reports the number of emulated instructions per second.
+ */
+
+#define ROM_SIZE (0x8000) // 32KB
+
+static const uint8_t bench_program[] = {
+    0x31, 0xFE, 0xDF,   // 0100: LD SP, DFFE
+    0x21, 0x00, 0xC0,   // 0103: LD HL, C000
+    0x06, 0x00,         // 0106: LD B, 0
+    0x3C,               // 0108: INC A          <- loop
+    0x80,               // 0109: ADD A, B
+    0x77,               // 010A: LD (HL), A
+    0x2C,               // 010B: INC L
+    0xCB, 0x47,         // 010C: BIT 0, A
+    0xCB, 0x37,         // 010E: SWAP A
+    0xA9,               // 0110: XOR C
+    0x4F,               // 0111: LD C, A
+    0xFE, 0x10,         // 0112: CP 10
+    0x05,               // 0114: DEC B
+    0x20, 0xF1,         // 0115: JR NZ, loop
+    0xC3, 0x06, 0x01,   // 0117: JP 0106
+};
+
+static double now_ms(void)
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv)
+{
+    long steps = (argc > 1) ? atol(argv[1]) : 50000000L;
+    static uint8_t rom_image[ROM_SIZE];
+    cpu_t cpu;
+
+    memcpy(&rom_image[0x0100], bench_program, sizeof(bench_program));
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_reset(&cpu);
+
+    double start = now_ms();
+    for (long i = 0; i < steps; ++i) {
+        cpu_step(&cpu, mem);
+    }
+    double elapsed = now_ms() - start;
+    uint64_t cycles = cpu.cycles;
+
+    printf("cpu_step: %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+           steps, (unsigned long long)cycles, elapsed,
+           steps / (elapsed * 1000.0));
+
+    /* Same amount of guest time through the threaded loop */
+    cpu_reset(&cpu);
+    start = now_ms();
+    cpu_run(&cpu, mem, cycles);
+    elapsed = now_ms() - start;
+
+    printf("cpu_run:  %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+           steps, (unsigned long long)cpu.cycles, elapsed,
+           steps / (elapsed * 1000.0));
+
+    /* Both again with the decoded-instruction cache attached */
+    cpu_icache_t *icache = cpu_icache_create();
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    start = now_ms();
+    for (long i = 0; i < steps; ++i) {
+        cpu_step(&cpu, mem);
+    }
+    elapsed = now_ms() - start;
+
+    printf("cpu_step+icache: %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+           steps, (unsigned long long)cpu.cycles, elapsed,
+           steps / (elapsed * 1000.0));
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    start = now_ms();
+    cpu_run(&cpu, mem, cycles);
+    elapsed = now_ms() - start;
+
+    printf("cpu_run+icache:  %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+           steps, (unsigned long long)cpu.cycles, elapsed,
+           steps / (elapsed * 1000.0));
+
+    /* And with superinstructions on top */
+    cpu_icache_fuse(icache, 1);
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    start = now_ms();
+    cpu_run(&cpu, mem, cycles);
+    elapsed = now_ms() - start;
+
+    printf("cpu_run+fuse:    %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+           steps, (unsigned long long)cpu.cycles, elapsed,
+           steps / (elapsed * 1000.0));
+
+    cpu_icache_destroy(icache);
+
+#ifdef BOYC_JIT
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (jit) {
+        cpu_reset(&cpu);
+        start = now_ms();
+        cpu_jit_run(jit, &cpu, mem, cycles);
+        elapsed = now_ms() - start;
+
+        printf("cpu_jit:  %ld instr, %llu cycles in %.1f ms (%.1f MIPS)\n",
+               steps, (unsigned long long)cpu.cycles, elapsed,
+               steps / (elapsed * 1000.0));
+        cpu_jit_destroy(jit);
+    }
+#endif
+
+    mem_reset(mem);
+    return 0;
+}
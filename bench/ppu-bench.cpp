@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "mem.h"
+#include "ppu.h"
+
+/**
+ * Micro benchmark for the PPU pixel kernels.
+ * Times tile decoding, palette expansion and whole frames (scanline
+ * renderer with every tile rewritten each frame) for each variant the
+ * host supports.
+ */
+
+#define ROM_SIZE (0x8000) // 32KB
+#define CYCLES_PER_FRAME (17556)
+
+static double now_ms(void)
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv)
+{
+    long reps = (argc > 1) ? atol(argv[1]) : 200000L;
+    static uint8_t tiles[384 * 16];
+    static uint8_t px[64], flipped[64];
+    static uint8_t idx[160];
+    static uint32_t out[160];
+    static const uint32_t pal[4] = {0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF};
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    static ppu_t ppu;
+    volatile uint32_t sink = 0;     /* keeps the results alive */
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(tiles); ++i) {
+        tiles[i] = (uint8_t)rand();
+    }
+    for (int i = 0; i < 160; ++i) {
+        idx[i] = (uint8_t)(rand() & 3);
+    }
+
+    for (int n = 0; n < ppu_kernels_count(); ++n) {
+        const ppu_kernels_t *k = ppu_kernels_variant(n);
+        if (!k) {
+            printf("variant %d not supported on this cpu\n", n);
+            continue;
+        }
+
+        double start = now_ms();
+        for (long r = 0; r < reps; ++r) {
+            k->decode_tile(tiles + (r % 384) * 16, px, flipped);
+            sink += px[r & 63];
+        }
+        double decode = now_ms() - start;
+
+        start = now_ms();
+        for (long r = 0; r < reps; ++r) {
+            idx[r % 160] ^= 1;
+            k->expand(idx, pal, out, 160);
+            sink += out[r % 160];
+        }
+        double expand = now_ms() - start;
+
+        /* Whole frames, all tiles dirty every frame */
+        const long frames = reps / 1000 + 1;
+        mem_t *mem = mem_create(rom_image, ROM_SIZE);
+        ppu_init(&ppu, frame, mem);
+        ppu.kernels = k;
+        start = now_ms();
+        for (long f = 0; f < frames; ++f) {
+            for (int i = 0; i < 384 * 16; ++i) {
+                mem_write_byte(mem, 0x8000 + i, tiles[i] ^ (uint8_t)f);
+            }
+            ppu_step(&ppu, CYCLES_PER_FRAME, mem);
+        }
+        double frame_ms = now_ms() - start;
+        sink += frame[0];
+        mem_reset(mem);
+
+        printf("%-7s decode %.1f Mtiles/s, expand %.1f Mlines/s, %.3f ms/frame\n",
+               k->name, reps / decode / 1000.0, reps / expand / 1000.0, frame_ms / frames);
+    }
+
+    return 0;
+}
@@ -4,18 +4,317 @@
 #include "cpu.h"
 #include "cpu_ops.h"
 
+/*
+* Dispatch tables: one indirect call per instruction
+*/
+#define OP_TABLE_ENTRY(opcode, fn) fn,
+
+static const cpu_op_fn op_table[OPS_COUNT] = {
+    CPU_OP_LIST(OP_TABLE_ENTRY)
+};
+
+/*
+* CB-prefixed opcodes, x = op, y = bit (or rotate kind), z = register.
+* Every (x, y, z) is its own instantiation, so neither the decode nor the
+* register selection is left for run time.
+*/
+template <uint8_t Z>
+static inline uint8_t cb_read(cpu_t *cpu, mem_t *m)
+{
+    if constexpr (Z == 0) return cpu->r.b;
+    else if constexpr (Z == 1) return cpu->r.c;
+    else if constexpr (Z == 2) return cpu->r.d;
+    else if constexpr (Z == 3) return cpu->r.e;
+    else if constexpr (Z == 4) return cpu->r.h;
+    else if constexpr (Z == 5) return cpu->r.l;
+    else if constexpr (Z == 6) return mem_read_byte(m, cpu->r.hl);
+    else return cpu->r.a;
+}
+
+template <uint8_t Z>
+static inline void cb_write(cpu_t *cpu, mem_t *m, uint8_t val)
+{
+    if constexpr (Z == 0) cpu->r.b = val;
+    else if constexpr (Z == 1) cpu->r.c = val;
+    else if constexpr (Z == 2) cpu->r.d = val;
+    else if constexpr (Z == 3) cpu->r.e = val;
+    else if constexpr (Z == 4) cpu->r.h = val;
+    else if constexpr (Z == 5) cpu->r.l = val;
+    else if constexpr (Z == 6) mem_write_byte(m, cpu->r.hl, val);
+    else cpu->r.a = val;
+}
+
+/* RLC RRC RL RR SLA SRA SWAP SRL, carry out through *carry */
+template <uint8_t Y>
+static inline uint8_t cb_shift(const cpu_t *cpu, uint8_t v, uint8_t *carry)
+{
+    if constexpr (Y == 0) { *carry = v >> 7; return (v << 1) | (v >> 7); }
+    else if constexpr (Y == 1) { *carry = v & 1; return (v >> 1) | (v << 7); }
+    else if constexpr (Y == 2) { *carry = v >> 7; return (v << 1) | cpu_flag(cpu, F_C); }
+    else if constexpr (Y == 3) { *carry = v & 1; return (v >> 1) | (cpu_flag(cpu, F_C) << 7); }
+    else if constexpr (Y == 4) { *carry = v >> 7; return v << 1; }
+    else if constexpr (Y == 5) { *carry = v & 1; return (v >> 1) | (v & 0x80); }
+    else if constexpr (Y == 6) { *carry = 0; return (v << 4) | (v >> 4); }
+    else { *carry = v & 1; return v >> 1; }
+}
+
+template <uint8_t X, uint8_t Y, uint8_t Z>
+static uint8_t op_cb(cpu_t *cpu, mem_t *m)
+{
+    uint8_t value = cb_read<Z>(cpu, m);
+
+    if constexpr (X == 0) {
+        /* rotate/shift: Z from the result, N and H clear */
+        uint8_t carry;
+        uint8_t result = cb_shift<Y>(cpu, value, &carry);
+        cpu_flags_record(cpu, CPU_LF_OR, result, carry, 0, 0, 0);
+        cb_write<Z>(cpu, m, result);
+    } else if constexpr (X == 1) {
+        /* BIT y, r: Z from the bit, H set, C kept */
+        cpu_flags_record(cpu, CPU_LF_AND, value & (1 << Y),
+                         cpu_flag(cpu, F_C), 0, 0, 0);
+    } else if constexpr (X == 2) {
+        cb_write<Z>(cpu, m, value & ~(1 << Y));        /* RES y, r */
+    } else {
+        cb_write<Z>(cpu, m, value | (1 << Y));         /* SET y, r */
+    }
+
+    cpu->pc += 2;
+    return (Z == 6) ? 4 : 2;
+}
+
+#define CB_OP(n)      op_cb<((n) >> 6), (((n) >> 3) & 7), ((n) & 7)>
+#define CB_ENTRY4(n)  CB_OP(n), CB_OP((n) + 1), CB_OP((n) + 2), CB_OP((n) + 3),
+#define CB_ENTRY16(n) CB_ENTRY4(n) CB_ENTRY4((n) + 4) CB_ENTRY4((n) + 8) CB_ENTRY4((n) + 12)
+#define CB_ENTRY64(n) CB_ENTRY16(n) CB_ENTRY16((n) + 16) CB_ENTRY16((n) + 32) CB_ENTRY16((n) + 48)
+
+const cpu_op_fn cpu_cb_table[OPS_COUNT] = {
+    CB_ENTRY64(0x00) CB_ENTRY64(0x40) CB_ENTRY64(0x80) CB_ENTRY64(0xC0)
+};
+
+/*
+* Decoded-instruction cache. ROM is immutable, so decoded entries for
+* 0000-7FFF stay valid as long as the same banks are mapped there. The
+* 4000-7FFF pages are checked on every fetch, bank 0 only moves on MBC1
+* and is checked once per step or after MEM_EV_BANK, together with the
+* exec watchpoints (pages with one are never cached).
+* Code running from RAM is always decoded on the fly. Pages of 256
+* entries are allocated on first use.
+*/
+#define ICACHE_PAGES        (0x8000 >> 8)
+#define ICACHE_ROMX_PAGE    (0x4000 >> 8)
+
+typedef struct {
+    cpu_op_fn fn;       /* handler, NULL if not decoded yet */
+    uint16_t  imm;      /* operand bytes */
+    uint8_t   opcode;
+    uint8_t   length;   /* bytes, including the opcode */
+    uint16_t  slot;     /* cpu_run label: opcode, or OPS_COUNT + n for fused pair n */
+} cpu_decoded_t;
+
+struct cpu_icache {
+    cpu_decoded_t *page[ICACHE_PAGES];
+    uint16_t       bank[ICACHE_PAGES];  /* ROM bank a page was decoded from */
+    uint8_t        fuse;                /* decode CPU_FUSE_LIST pairs as one slot */
+    uint32_t       code_map;            /* mem_code_map() the cached pages were decoded with */
+};
+
+/*
+* Superinstructions for cpu_run: X(n, first, second, first_fn, second_fn).
+* A fused slot runs both handlers back to back, RUN_CONTINUE is still
+* checked in between, so cycles and interrupt boundaries are exactly those
+* of two separate dispatches. The first op must fall through to the second
+* and must not write memory (a bank switch would make the second stale).
+* tools/pair_freq.cpp lists candidate pairs for a ROM.
+*/
+#define CPU_FUSE_LIST(X) \
+    X(0, 0x2A, 0x12, op_ld_a_mhli, op_ld_mde_a)  /* LD A,(HL+); LD (DE),A */ \
+    X(1, 0x05, 0x20, op_dec_b, op_jr_nz_s8)      /* DEC B; JR NZ          */ \
+    X(2, 0x0D, 0x20, op_dec_c, op_jr_nz_s8)      /* DEC C; JR NZ          */ \
+    X(3, 0xFE, 0x28, op_cp_d8, op_jr_z_s8)       /* CP d8; JR Z           */ \
+    X(4, 0xFE, 0x20, op_cp_d8, op_jr_nz_s8)      /* CP d8; JR NZ          */ \
+    X(5, 0xF0, 0xE6, op_ld_a_ma8, op_and_d8)     /* LDH A,(a8); AND d8    */
+
+#define FUSE_PAIR(n, first, second, first_fn, second_fn) (((first) << 8) | (second)),
+
+static const uint16_t fuse_pairs[] = {
+    CPU_FUSE_LIST(FUSE_PAIR)
+};
+
+#define FUSE_COUNT ((int)(sizeof(fuse_pairs) / sizeof(fuse_pairs[0])))
+
+cpu_icache_t *cpu_icache_create(void)
+{
+    return (cpu_icache_t *)calloc(1, sizeof(cpu_icache_t));
+}
+
+void cpu_icache_fuse(cpu_icache_t *ic, int on)
+{
+    ic->fuse = on ? 1 : 0;
+    for (int i = 0; i < ICACHE_PAGES; ++i) {   /* slots were decoded with the old setting */
+        if (ic->page[i]) {
+            memset(ic->page[i], 0, 256 * sizeof(cpu_decoded_t));
+        }
+    }
+}
+
+void cpu_icache_destroy(cpu_icache_t *ic)
+{
+    if (!ic) {
+        return;
+    }
+    for (int i = 0; i < ICACHE_PAGES; ++i) {
+        free(ic->page[i]);
+    }
+    free(ic);
+}
+
+static inline void cpu_decode(mem_t *m, uint16_t pc, cpu_decoded_t *d)
+{
+    uint8_t opcode = mem_fetch_byte(m, pc);
+
+    d->opcode = opcode;
+    d->length = op_length[opcode];
+    d->fn = op_table[opcode];
+    d->slot = opcode;
+
+    if (d->length == 2) {
+        d->imm = mem_peek_byte(m, pc + 1);    /* operands are not data reads */
+    } else if (d->length == 3) {
+        d->imm = mem_peek_word(m, pc + 1);
+    } else {
+        d->imm = 0;
+    }
+
+    if (opcode == 0xCB) {
+        d->fn = cpu_cb_table[(uint8_t)d->imm];   /* skip the second dispatch */
+    }
+}
+
+/* Operands reaching into the next 16K region depend on another bank, and
+ * nothing fetched under OAM DMA (reads FF) or from an exec-watched page
+ * (has to be fetched every time) is kept */
+static inline int cpu_decoded_cacheable(mem_t *m, uint16_t pc, const cpu_decoded_t *d)
+{
+    return ((pc + d->length - 1) & 0xC000) == (pc & 0xC000) && mem_fetch_cacheable(m, pc);
+}
+
+/* Turn a freshly cached entry into a fused slot if it starts a
+ * CPU_FUSE_LIST pair, the second op is cached on the same page (and
+ * checked in turn if it was not cached yet) */
+static void cpu_fuse(mem_t *m, cpu_decoded_t *entries, uint16_t pc)
+{
+    for (;;) {
+        cpu_decoded_t *first = &entries[pc & 0xFF];
+        uint16_t next = pc + first->length;
+        int starts_pair = 0;
+
+        for (int n = 0; n < FUSE_COUNT; ++n) {
+            starts_pair |= (fuse_pairs[n] >> 8) == first->opcode;
+        }
+        if (!starts_pair || (next >> 8) != (pc >> 8)) {
+            return;
+        }
+
+        cpu_decoded_t *second = &entries[next & 0xFF];
+        const int cached = second->fn != NULL;
+        if (!cached) {
+            cpu_decoded_t d;
+            cpu_decode(m, next, &d);
+            if (!cpu_decoded_cacheable(m, next, &d)) {
+                return;
+            }
+            *second = d;
+        }
+
+        const uint16_t pair = (first->opcode << 8) | second->opcode;
+        for (int n = 0; n < FUSE_COUNT; ++n) {
+            if (fuse_pairs[n] == pair) {
+                first->slot = OPS_COUNT + n;
+            }
+        }
+        if (cached) {
+            return;
+        }
+        pc = next;
+    }
+}
+
+/* Drop the 0000-3FFF pages once a different bank is mapped there, and
+ * everything once the exec watchpoints change */
+static inline void cpu_icache_check_map(cpu_icache_t *ic, mem_t *m)
+{
+    const uint32_t map = ic ? mem_code_map(m) : 0;
+
+    if (ic && ic->code_map != map) {
+        /* bank 0 moved: ROM0 pages, exec watches changed: all of them */
+        const int pages = ((ic->code_map ^ map) >> 16) ? ICACHE_PAGES : ICACHE_ROMX_PAGE;
+        for (int i = 0; i < pages; ++i) {
+            if (ic->page[i]) {
+                memset(ic->page[i], 0, 256 * sizeof(cpu_decoded_t));
+            }
+        }
+        ic->code_map = map;
+    }
+}
+
+/* Fetch/decode stage: cached entry for ROM code, scratch otherwise. While
+ * OAM DMA holds the bus every fetch goes to the bus (and reads FF). */
+static inline const cpu_decoded_t *cpu_fetch(cpu_t *cpu, mem_t *m, cpu_decoded_t *scratch,
+                                             int bus_locked)
+{
+    const uint16_t pc = cpu->pc;
+    cpu_icache_t *ic = cpu->icache;
+
+    if (!ic || pc >= 0x8000 || bus_locked) {
+        cpu_decode(m, pc, scratch);
+        return scratch;
+    }
+
+    const uint8_t page = pc >> 8;
+    cpu_decoded_t *entries = ic->page[page];
+
+    if (entries && page >= ICACHE_ROMX_PAGE && ic->bank[page] != mem_rom_bank(m)) {
+        memset(entries, 0, 256 * sizeof(cpu_decoded_t));   /* bank switched */
+        ic->bank[page] = mem_rom_bank(m);
+    }
+    if (entries && entries[pc & 0xFF].fn) {
+        return &entries[pc & 0xFF];
+    }
+
+    cpu_decode(m, pc, scratch);
+    if (!cpu_decoded_cacheable(m, pc, scratch)) {
+        return scratch;
+    }
+    if (!entries) {
+        entries = (cpu_decoded_t *)calloc(256, sizeof(cpu_decoded_t));
+        if (!entries) {
+            return scratch;
+        }
+        ic->page[page] = entries;
+        ic->bank[page] = (page >= ICACHE_ROMX_PAGE) ? mem_rom_bank(m) : (uint16_t)ic->code_map;
+    }
+    entries[pc & 0xFF] = *scratch;
+    if (ic->fuse) {
+        cpu_fuse(m, entries, pc);
+    }
+    return &entries[pc & 0xFF];
+}
+
 /*
 * For debugging purpose
 */
 void cpu_dump(const cpu_t *cpu)
 {
+    uint8_t f = cpu_flags_value(cpu);
+
     printf("AF:%04X BC:%04X DE:%04X HL:%04X  PC:%04X SP:%04X  F:%c%c%c%c\n",
-           cpu->r.af, cpu->r.bc, cpu->r.de, cpu->r.hl,
+           (cpu->r.a << 8) | f, cpu->r.bc, cpu->r.de, cpu->r.hl,
            cpu->pc, cpu->sp,
-           cpu_get_flag(&cpu->r,F_Z)?'Z':'-',
-           cpu_get_flag(&cpu->r,F_N)?'N':'-',
-           cpu_get_flag(&cpu->r,F_H)?'H':'-',
-           cpu_get_flag(&cpu->r,F_C)?'C':'-');
+           (f & F_Z)?'Z':'-',
+           (f & F_N)?'N':'-',
+           (f & F_H)?'H':'-',
+           (f & F_C)?'C':'-');
 }
 
 void cpu_reset(cpu_t *cpu)
@@ -29,17 +328,19 @@ void cpu_reset(cpu_t *cpu)
     cpu->r.hl = 0x014D;
     cpu->sp   = 0xFFFE;
     cpu->pc   = 0x0100;          /* first cartridge byte after the header */
+    cpu->run_end = UINT64_MAX;
 }
 
-int8_t cpu_step(cpu_t *cpu, mem_t *m)
+/* Dispatch a pending, enabled interrupt. Returns 1 if one was taken. */
+static inline int cpu_interrupt(cpu_t *cpu, mem_t *m)
 {
-    uint8_t cycles = 1;
-
-    /* Handle interrupts before executing the next opcode */
     uint8_t ie = mem_read_byte(m, 0xFFFF);   /* Interrupt Enable register */
     uint8_t iflag = mem_read_byte(m, 0xFF0F); /* Interrupt Flag register  */
-    uint8_t pending = ie & iflag;
+    uint8_t pending = ie & iflag & 0x1F;
 
+    if (pending) {
+        cpu->halted = 0;                        /* any request ends HALT   */
+    }
     if (cpu->ime && pending) {
         static const uint16_t vectors[5] = {0x40, 0x48, 0x50, 0x58, 0x60};
         for (int i = 0; i < 5; ++i) {
@@ -49,769 +350,260 @@ int8_t cpu_step(cpu_t *cpu, mem_t *m)
                 push_word(cpu, m, cpu->pc);     /* save current PC         */
                 cpu->pc = vectors[i];
                 cpu->cycles += 5;               /* interrupt latency       */
-                return 0;
+                return 1;
             }
         }
     }
+    return 0;
+}
 
-    uint8_t opcode = mem_read_byte(m, cpu->pc);
+int cpu_service_interrupt(cpu_t *cpu, mem_t *m)
+{
+    return cpu_interrupt(cpu, m);
+}
 
-    switch (opcode)
-    {
-        case 0x00:
-            cycles = nop(cpu);
-            break;
-        case 0x01:
-            cycles = op_ld_bc_d16(cpu, m);
-            break;
-        case 0x02:
-            cycles = op_ld_bc_a(cpu, m);
-            break;
-        case 0x03:
-            cycles = op_inc_bc(cpu);
-            break;
-        case 0x04:
-            cycles = op_inc_b(cpu);
-            break;
-        case 0x05:
-            cycles = op_dec_b(cpu);
-            break;
-        case 0x06:
-            cycles = op_ld_b_d8(cpu, m);
-            break;
-        case 0x08:
-            cycles = op_ld_a16_sp(cpu, m);
-            break;
-        case 0x09:
-            cycles = op_add_hl_bc(cpu);
-            break;
-        case 0x0A:
-            cycles = op_ld_a_bc(cpu, m);
-            break;
-        case 0x0B:
-            cycles = op_dec_bc(cpu);
-            break;
-        case 0x0C:
-            cycles = op_inc_c(cpu);
-            break;
-        case 0x0D:
-            cycles = op_dec_c(cpu);
-            break;
-        case 0x0E:
-            cycles = op_ld_c_d8(cpu, m);
-            break;
-        case 0x10:
-            cycles = op_stop(cpu);
-            break;
-        case 0x14:
-            cycles = op_inc_d(cpu);
-            break;
-        case 0x15:
-            cycles = op_dec_d(cpu);
-            break;
-        case 0x16:
-            cycles = op_ld_d_d8(cpu, m);
-            break;
-        case 0x17:
-            cycles = op_rla(cpu);
-            break;
-        case 0x0F:
-            cycles = op_rrca(cpu);
-            break;
-        case 0x07:
-            cycles = op_rlca(cpu);
-            break;
-        case 0x11:
-            cycles = op_ld_de_d16(cpu, m);
-            break;
-        case 0x12:
-            cycles = op_ld_de_a(cpu, m);
-            break;
-        case 0x13:
-            cycles = op_inc_de(cpu);
-            break;
-        case 0x19:
-            cycles = op_add_hl_de(cpu);
-            break;
-        case 0x29:
-            cycles = op_add_hl_hl(cpu);
-            break;
-        case 0x39:
-            cycles = op_add_hl_sp(cpu);
-            break;
-        case 0x1A:
-            cycles = op_ld_a_de(cpu, m);
-            break;
-        case 0x1B:
-            cycles = op_dec_de(cpu);
-            break;
-        case 0x1C:
-            cycles = op_inc_e(cpu);
-            break;
-        case 0x1D:
-            cycles = op_dec_e(cpu);
-            break;
-        case 0x1E:
-            cycles = op_ld_e_d8(cpu, m);
-            break;
-        case 0x1F:
-            cycles = op_rra(cpu);
-            break;
-        case 0x18:
-            cycles = op_jr_s8(cpu, m);
-            break;
-        case 0x20:
-            cycles = op_jr_nz_s8(cpu, m);
-            break;
-        case 0x21:
-            cycles = op_ld_hl_d16(cpu, m);
-            break;
-        case 0x22:
-            cycles = op_ld_hl_inc_a(cpu, m);
-            break;
-        case 0x23:
-            cycles = op_inc_hl(cpu);
-            break;
-        case 0x24:
-            cycles = op_inc_h(cpu);
-            break;
-        case 0x25:
-            cycles = op_dec_h(cpu);
-            break;
-        case 0x26:
-            cycles = op_ld_h_d8(cpu, m);
-            break;
-        case 0x27:
-            cycles = op_daa(cpu);
-            break;
-        case 0x28:
-            cycles = op_jr_z_s8(cpu, m);
-            break;
-        case 0x30:
-            cycles = op_jr_nc_s8(cpu, m);
-            break;
-        case 0x2A:
-            cycles = op_ld_a_hl_inc(cpu, m);
-            break;
-        case 0x2B:
-            cycles = op_dec_hl(cpu);
-            break;
-        case 0x2E:
-            cycles = op_ld_l_d8(cpu, m);
-            break;
-        case 0x2F:
-            cycles = op_cpl(cpu);
-            break;
-        case 0x2C:
-            cycles = op_inc_l(cpu);
-            break;
-        case 0x2D:
-            cycles = op_dec_l(cpu);
-            break;
-        case 0x31:
-            cycles = op_ld_sp_d16(cpu, m);
-            break;
-        case 0x32:
-            cycles = op_ld_hl_dec_a(cpu, m);
-            break;
-        case 0x38:
-            cycles = op_jr_c_s8(cpu, m);
-            break;
-        case 0x3A:
-            cycles = op_ld_a_hl_dec(cpu, m);
-            break;
-        case 0x33:
-            cycles = op_inc_sp(cpu);
-            break;
-        case 0x3B:
-            cycles = op_dec_sp(cpu);
-            break;
-        case 0x3C:
-            cycles = op_inc_a(cpu);
-            break;
-        case 0x3D:
-            cycles = op_dec_a(cpu);
-            break;
-        case 0x37:
-            cycles = op_scf(cpu);
-            break;
-        case 0x3F:
-            cycles = op_ccf(cpu);
-            break;
-        case 0x40:
-            cycles = op_ld_b_b(cpu, m);
-            break;
-        case 0x41:
-            cycles = op_ld_b_c(cpu, m);
-            break;
-        case 0x42:
-            cycles = op_ld_b_d(cpu);
-            break;
-        case 0x43:
-            cycles = op_ld_b_e(cpu);
-            break;
-        case 0x44:
-            cycles = op_ld_b_h(cpu);
-            break;
-        case 0x45:
-            cycles = op_ld_b_l(cpu);
-            break;
-        case 0x46:
-            cycles = op_ld_b_hl(cpu, m);
-            break;
-        case 0x47:
-            cycles = op_ld_b_a(cpu);
-            break;
-        case 0x48:
-            cycles = op_ld_c_b(cpu);
-            break;
-        case 0x49:
-            cycles = op_ld_c_c(cpu);
-            break;
-        case 0x4A:
-            cycles = op_ld_c_d(cpu);
-            break;
-        case 0x4B:
-            cycles = op_ld_c_e(cpu);
-            break;
-        case 0x4C:
-            cycles = op_ld_c_h(cpu);
-            break;
-        case 0x4D:
-            cycles = op_ld_c_l(cpu);
-            break;
-        case 0x4E:
-            cycles = op_ld_c_hl(cpu, m);
-            break;
-        case 0x4F:
-            cycles = op_ld_c_a(cpu);
-            break;
-        case 0x50:
-            cycles = op_ld_d_b(cpu);
-            break;
-        case 0x51:
-            cycles = op_ld_d_c(cpu);
-            break;
-        case 0x52:
-            cycles = op_ld_d_d(cpu);
-            break;
-        case 0x53:
-            cycles = op_ld_d_e(cpu);
-            break;
-        case 0x54:
-            cycles = op_ld_d_h(cpu);
-            break;
-        case 0x55:
-            cycles = op_ld_d_l(cpu);
-            break;
-        case 0x56:
-            cycles = op_ld_d_hl(cpu, m);
-            break;
-        case 0x57:
-            cycles = op_ld_d_a(cpu);
-            break;
-        case 0x58:
-            cycles = op_ld_e_b(cpu);
-            break;
-        case 0x59:
-            cycles = op_ld_e_c(cpu);
-            break;
-        case 0x5A:
-            cycles = op_ld_e_d(cpu);
-            break;
-        case 0x5B:
-            cycles = op_ld_e_e(cpu);
-            break;
-        case 0x5C:
-            cycles = op_ld_e_h(cpu);
-            break;
-        case 0x5D:
-            cycles = op_ld_e_l(cpu);
-            break;
-        case 0x5E:
-            cycles = op_ld_e_hl(cpu, m);
-            break;
-        case 0x5F:
-            cycles = op_ld_e_a(cpu);
-            break;
-        case 0x60:
-            cycles = op_ld_h_b(cpu);
-            break;
-        case 0x61:
-            cycles = op_ld_h_c(cpu);
-            break;
-        case 0x62:
-            cycles = op_ld_h_d(cpu);
-            break;
-        case 0x63:
-            cycles = op_ld_h_e(cpu);
-            break;
-        case 0x64:
-            cycles = op_ld_h_h(cpu);
-            break;
-        case 0x65:
-            cycles = op_ld_h_l(cpu);
-            break;
-        case 0x66:
-            cycles = op_ld_h_hl(cpu, m);
-            break;
-        case 0x67:
-            cycles = op_ld_h_a(cpu);
-            break;
-        case 0x68:
-            cycles = op_ld_l_b(cpu);
-            break;
-        case 0x69:
-            cycles = op_ld_l_c(cpu);
-            break;
-        case 0x6A:
-            cycles = op_ld_l_d(cpu);
-            break;
-        case 0x6B:
-            cycles = op_ld_l_e(cpu);
-            break;
-        case 0x6C:
-            cycles = op_ld_l_h(cpu);
-            break;
-        case 0x6D:
-            cycles = op_ld_l_l(cpu);
-            break;
-        case 0x6E:
-            cycles = op_ld_l_hl(cpu, m);
-            break;
-        case 0x6F:
-            cycles = op_ld_l_a(cpu);
-            break;
-        case 0x70:
-            cycles = op_ld_hl_b(cpu, m);
-            break;
-        case 0x71:
-            cycles = op_ld_hl_c(cpu, m);
-            break;
-        case 0x72:
-            cycles = op_ld_hl_d(cpu, m);
-            break;
-        case 0x73:
-            cycles = op_ld_hl_e(cpu, m);
-            break;
-        case 0x74:
-            cycles = op_ld_hl_h(cpu, m);
-            break;
-        case 0x75:
-            cycles = op_ld_hl_l(cpu, m);
-            break;
-        case 0x76:
-            cycles = op_halt(cpu);
-            break;
-        case 0x34:
-            cycles = op_inc_mem_hl(cpu, m);
-            break;
-        case 0x35:
-            cycles = op_dec_mem_hl(cpu, m);
-            break;
-        case 0x36:
-            cycles = op_ld_hl_d8(cpu, m);
-            break;
-        case 0x3E:
-            cycles = op_ld_a_d8(cpu, m);
-            break;
-        case 0x77:
-            cycles = op_ld_hl_a(cpu, m);
-            break;
-        case 0x7E:
-            cycles = op_ld_a_hl(cpu, m);
-            break;
-        case 0x78:
-            cycles = op_ld_a_b(cpu);
-            break;
-        case 0x79:
-            cycles = op_ld_a_c(cpu);
-            break;
-        case 0x7A:
-            cycles = op_ld_a_d(cpu);
-            break;
-        case 0x7B:
-            cycles = op_ld_a_e(cpu);
-            break;
-        case 0x7C:
-            cycles = op_ld_a_h(cpu);
-            break;
-        case 0x7D:
-            cycles = op_ld_a_l(cpu);
-            break;
-        case 0x7F:
-            cycles = op_ld_a_a(cpu);
-            break;
-        case 0x80:
-            cycles = op_add_a_b(cpu);
-            break;
-        case 0x81:
-            cycles = op_add_a_c(cpu);
-            break;
-        case 0x82:
-            cycles = op_add_a_d(cpu);
-            break;
-        case 0x83:
-            cycles = op_add_a_e(cpu);
-            break;
-        case 0x84:
-            cycles = op_add_a_h(cpu);
-            break;
-        case 0x85:
-            cycles = op_add_a_l(cpu);
-            break;
-        case 0x86:
-            cycles = op_add_a_hl(cpu, m);
-            break;
-        case 0x87:
-            cycles = op_add_a_a(cpu);
-            break;
-        case 0x88:
-            cycles = op_adc_a_b(cpu);
-            break;
-        case 0x89:
-            cycles = op_adc_a_c(cpu);
-            break;
-        case 0x8A:
-            cycles = op_adc_a_d(cpu);
-            break;
-        case 0x8B:
-            cycles = op_adc_a_e(cpu);
-            break;
-        case 0x8C:
-            cycles = op_adc_a_h(cpu);
-            break;
-        case 0x8D:
-            cycles = op_adc_a_l(cpu);
-            break;
-        case 0x8E:
-            cycles = op_adc_a_hl(cpu, m);
-            break;
-        case 0x8F:
-            cycles = op_adc_a_a(cpu);
-            break;
-        case 0xC6:
-            cycles = op_add_a_d8(cpu, m);
-            break;
-        case 0xCE:
-            cycles = op_adc_a_d8(cpu, m);
-            break;
-        case 0x90:
-            cycles = op_sub_b(cpu);
-            break;
-        case 0x91:
-            cycles = op_sub_c(cpu);
-            break;
-        case 0x92:
-            cycles = op_sub_d(cpu);
-            break;
-        case 0x93:
-            cycles = op_sub_e(cpu);
-            break;
-        case 0x94:
-            cycles = op_sub_h(cpu);
-            break;
-        case 0x95:
-            cycles = op_sub_l(cpu);
-            break;
-        case 0x96:
-            cycles = op_sub_hl(cpu, m);
-            break;
-        case 0x97:
-            cycles = op_sub_a_a(cpu);
-            break;
-        case 0x98:
-            cycles = op_sbc_a_b(cpu);
-            break;
-        case 0x99:
-            cycles = op_sbc_a_c(cpu);
-            break;
-        case 0x9A:
-            cycles = op_sbc_a_d(cpu);
-            break;
-        case 0x9B:
-            cycles = op_sbc_a_e(cpu);
-            break;
-        case 0x9C:
-            cycles = op_sbc_a_h(cpu);
-            break;
-        case 0x9D:
-            cycles = op_sbc_a_l(cpu);
-            break;
-        case 0x9E:
-            cycles = op_sbc_a_hl(cpu, m);
-            break;
-        case 0x9F:
-            cycles = op_sbc_a_a(cpu);
-            break;
-        case 0xD6:
-            cycles = op_sub_d8(cpu, m);
-            break;
-        case 0xDE:
-            cycles = op_sbc_a_d8(cpu, m);
-            break;
-        case 0xA0:
-            cycles = op_and_b(cpu);
-            break;
-        case 0xA1:
-            cycles = op_and_c(cpu);
-            break;
-        case 0xA2:
-            cycles = op_and_d(cpu);
-            break;
-        case 0xA3:
-            cycles = op_and_e(cpu);
-            break;
-        case 0xA4:
-            cycles = op_and_h(cpu);
-            break;
-        case 0xA5:
-            cycles = op_and_l(cpu);
-            break;
-        case 0xA6:
-            cycles = op_and_hl(cpu, m);
-            break;
-        case 0xA7:
-            cycles = op_and_a_a(cpu);
-            break;
-        case 0xA8:
-            cycles = op_xor_b(cpu);
-            break;
-        case 0xA9:
-            cycles = op_xor_c(cpu);
-            break;
-        case 0xAA:
-            cycles = op_xor_d(cpu);
-            break;
-        case 0xAB:
-            cycles = op_xor_e(cpu);
-            break;
-        case 0xAC:
-            cycles = op_xor_h(cpu);
-            break;
-        case 0xAD:
-            cycles = op_xor_l(cpu);
-            break;
-        case 0xAE:
-            cycles = op_xor_hl(cpu, m);
-            break;
-        case 0xAF:
-            cycles = op_xor_a_a(cpu);
-            break;
-        case 0xB0:
-            cycles = op_or_b(cpu);
-            break;
-        case 0xB1:
-            cycles = op_or_c(cpu);
-            break;
-        case 0xB2:
-            cycles = op_or_d(cpu);
-            break;
-        case 0xB3:
-            cycles = op_or_e(cpu);
-            break;
-        case 0xB4:
-            cycles = op_or_h(cpu);
-            break;
-        case 0xB5:
-            cycles = op_or_l(cpu);
-            break;
-        case 0xB6:
-            cycles = op_or_hl(cpu, m);
-            break;
-        case 0xB7:
-            cycles = op_or_a_a(cpu);
-            break;
-        case 0xB8:
-            cycles = op_cp_b(cpu);
-            break;
-        case 0xB9:
-            cycles = op_cp_c(cpu);
-            break;
-        case 0xBA:
-            cycles = op_cp_d(cpu);
-            break;
-        case 0xBB:
-            cycles = op_cp_e(cpu);
-            break;
-        case 0xBC:
-            cycles = op_cp_h(cpu);
-            break;
-        case 0xBD:
-            cycles = op_cp_l(cpu);
-            break;
-        case 0xBE:
-            cycles = op_cp_hl(cpu, m);
-            break;
-        case 0xBF:
-            cycles = op_cp_a_a(cpu);
-            break;
-        case 0xF6:
-            cycles = op_or_d8(cpu, m);
-            break;
-        case 0xF3:
-            cycles = op_di(cpu);
-            break;
-        case 0xFB:
-            cycles = op_ei(cpu);
-            break;
-        case 0xC0:
-            cycles = op_ret_nz(cpu, m);
-            break;
-        case 0xC1:
-            cycles = op_pop_bc(cpu, m);
-            break;
-        case 0xC4:
-            cycles = op_call_nz_a16(cpu, m);
-            break;
-        case 0xC5:
-            cycles = op_push_bc(cpu, m);
-            break;
-        case 0xC7:
-            cycles = op_rst_00(cpu, m);
-            break;
-        case 0xC8:
-            cycles = op_ret_z(cpu, m);
-            break;
-        case 0xC9:
-            cycles = op_ret(cpu, m);
-            break;
-        case 0xCA:
-            cycles = op_jp_z_a16(cpu, m);
-            break;
-        case 0xCC:
-            cycles = op_call_z_a16(cpu, m);
-            break;
-        case 0xCD:
-            cycles = op_call_a16(cpu, m);
-            break;
-        case 0xCF:
-            cycles = op_rst_08(cpu, m);
-            break;
-        case 0xD0:
-            cycles = op_ret_nc(cpu, m);
-            break;
-        case 0xD1:
-            cycles = op_pop_de(cpu, m);
-            break;
-        case 0xD2:
-            cycles = op_jp_nc_a16(cpu, m);
-            break;
-        case 0xD4:
-            cycles = op_call_nc_a16(cpu, m);
-            break;
-        case 0xD5:
-            cycles = op_push_de(cpu, m);
-            break;
-        case 0xD7:
-            cycles = op_rst_10(cpu, m);
-            break;
-        case 0xD8:
-            cycles = op_ret_c(cpu, m);
-            break;
-        case 0xD9:
-            cycles = op_reti(cpu, m);
-            break;
-        case 0xDA:
-            cycles = op_jp_c_a16(cpu, m);
-            break;
-        case 0xDC:
-            cycles = op_call_c_a16(cpu, m);
-            break;
-        case 0xDF:
-            cycles = op_rst_18(cpu, m);
-            break;
-        case 0xE0:
-            cycles = op_ldh_a8_a(cpu, m);
-            break;
-        case 0xE1:
-            cycles = op_pop_hl(cpu, m);
-            break;
-        case 0xE2:
-            cycles = op_ld_c_a_ind(cpu, m);
-            break;
-        case 0xE5:
-            cycles = op_push_hl(cpu, m);
-            break;
-        case 0xE7:
-            cycles = op_rst_20(cpu, m);
-            break;
-        case 0xE8:
-            cycles = op_add_sp_r8(cpu, m);
-            break;
-        case 0xE9:
-            cycles = op_jp_hl(cpu);
-            break;
-        case 0xEF:
-            cycles = op_rst_28(cpu, m);
-            break;
-        case 0xF1:
-            cycles = op_pop_af(cpu, m);
-            break;
-        case 0xF2:
-            cycles = op_ld_a_c_ind(cpu, m);
-            break;
-        case 0xF5:
-            cycles = op_push_af(cpu, m);
-            break;
-        case 0xF7:
-            cycles = op_rst_30(cpu, m);
-            break;
-        case 0xC2:
-            cycles = op_jp_nz_a16(cpu, m);
-            break;
-        case 0xC3:
-            cycles = op_jp_a16(cpu, m);
-            break;
-        case 0xF0:
-            cycles = op_ld_a_a8(cpu, m);
-            break;
-        case 0xF8:
-            cycles = op_ld_hl_sp_r8(cpu, m);
-            break;
-        case 0xF9:
-            cycles = op_ld_sp_hl(cpu);
-            break;
-        case 0xFA:
-            cycles = op_ld_a_a16(cpu, m);
-            break;
-        case 0xEE:
-            cycles = op_xor_d8(cpu, m);
-            break;
-        case 0xFF:
-            cycles = op_rst_38(cpu, m);
-            break;
-        case 0xFE:
-            cycles = op_cp_d8(cpu, m);
-            break;
-        case 0xE6:
-            cycles = op_and_d8(cpu, m);
-            break;
-        case 0xCB:
-            cycles = op_prefix_cb(cpu, m);
-            break;
-        case 0xD3:
-        case 0xDB:
-        case 0xDD:
-        case 0xE3:
-        case 0xE4:
-        case 0xEB:
-        case 0xEC:
-        case 0xED:
-        case 0xF4:
-        case 0xFC:
-        case 0xFD:
-            cycles = nop(cpu);
-            break;
-        case 0xEA:
-            cycles = op_ld_a16_a(cpu, m);
-            break;
-        default:
-            fprintf(stderr,"Unknown opcode %x\n", opcode);
-            return -1;
+void cpu_idle(cpu_t *cpu, uint64_t limit)
+{
+    uint64_t target = limit;
+
+    if (cpu->event_at > cpu->cycles && cpu->event_at < limit) {
+        target = cpu->event_at;
+    }
+    if (target > cpu->cycles) {
+        cpu->cycles = target;
+    }
+}
+
+/*
+* Idle-loop detector. A short backward JR loop whose body only reads STAT
+* or LY (and tests them in A/F) does the same thing on every pass until
+* that register changes, which can only happen at the next PPU mode change
+* the host put in event_at. Loops on DIV, TIMA, JOYP, IF, ... change at
+* other times and are left alone. Once two passes took the same number of
+* cycles the remaining passes up to event_at are skipped in one go, but
+* never past the end of the cpu_run budget.
+*/
+#define IDLE_LOOP_MAX_BYTES (16)
+
+static inline int idle_loop_reg_ok(uint16_t adr)
+{
+    return adr == 0xFF41 || adr == 0xFF44;  /* STAT, LY */
+}
+
+static int idle_loop_body_ok(const cpu_t *cpu, mem_t *m,
+                             uint16_t target, uint16_t branch_pc)
+{
+    uint16_t pc = target;
+
+    while (pc < branch_pc) {
+        uint8_t op = mem_peek_byte(m, pc);        /* looking, not loading */
+        uint8_t arg = mem_peek_byte(m, pc + 1);
+
+        switch (op)
+        {
+            case 0x00:                      /* NOP                */
+            case 0xA7: case 0xB7: case 0xBF: /* AND A, OR A, CP A  */
+            case 0xE6: case 0xFE:           /* AND d8, CP d8      */
+                break;
+            case 0xF0:                      /* LDH A, (a8)        */
+                if (!idle_loop_reg_ok(0xFF00 | arg)) return 0;
+                break;
+            case 0xF2:                      /* LD A, (C)          */
+                if (!idle_loop_reg_ok(0xFF00 | cpu->r.c)) return 0;
+                break;
+            case 0xFA: {                    /* LD A, (a16)        */
+                uint16_t a16 = arg | (mem_peek_byte(m, pc + 2) << 8);
+                if (!idle_loop_reg_ok(a16)) return 0;
+                break;
+            }
+            case 0xCB:                      /* BIT n, A           */
+                if ((arg & 0xC7) != 0x47) return 0;
+                break;
+            default:
+                return 0;
+        }
+        pc += op_length[op];
+    }
+    return pc == branch_pc;
+}
+
+void cpu_idle_loop(cpu_t *cpu, mem_t *m, uint16_t branch_pc)
+{
+    cpu_idle_loop_t *il = &cpu->idleloop;
+    uint16_t bank = mem_rom_bank(m);
+
+    if (il->pc != branch_pc || il->bank != bank) {
+        il->pc = branch_pc;
+        il->bank = bank;
+        il->ok = branch_pc < 0x8000 &&
+                 (uint16_t)(branch_pc - cpu->pc) < IDLE_LOOP_MAX_BYTES &&
+                 idle_loop_body_ok(cpu, m, cpu->pc, branch_pc);
+        il->last = cpu->cycles;
+        il->period = 0;
+        return;
+    }
+    if (!il->ok) {
+        return;
+    }
+
+    uint64_t period = cpu->cycles - il->last;
+    il->last = cpu->cycles;
+    if (period != il->period) {     /* e.g. an interrupt ran in between */
+        il->period = period;
+        return;
+    }
+
+    const uint64_t limit = (cpu->run_end < cpu->event_at) ? cpu->run_end : cpu->event_at;
+    if (limit > cpu->cycles + period) {
+        uint64_t skip = (limit - cpu->cycles) / period * period;
+        cpu->cycles += skip;
+        il->last = cpu->cycles;
+        il->skips++;
+        il->skipped += skip;
+    }
+}
+
+int8_t cpu_step(cpu_t *cpu, mem_t *m)
+{
+    uint8_t cycles = 1;
+
+    /* Handle interrupts before executing the next opcode */
+    if (cpu_interrupt(cpu, m)) {
+        return 0;
+    }
+
+    /* Halted: nothing can happen before the next scheduled event */
+    if (cpu->halted) {
+        cpu_idle(cpu, (cpu->event_at > cpu->cycles) ? cpu->event_at
+                                                    : cpu->cycles + 1);
+        return 0;
+    }
+
+    cpu_decoded_t scratch;
+    cpu_icache_check_map(cpu->icache, m);
+    const cpu_decoded_t *d = cpu_fetch(cpu, m, &scratch, mem_dma_active(m));
+    cpu->imm = d->imm;
+    cycles = d->fn(cpu, m);
+    cpu_flags_sync(cpu);     /* callers may look at r.f between steps */
+    if (d->fn == op_illegal) {
+        return -1;
     }
 
     cpu->cycles += cycles;   // timing table
     return 0;
 }
 
+/*
+* Threaded interpreter loop. Interrupts are only re-checked when the bus
+* reports an event (e.g. a write to IF/IE) or an instruction changes IME,
+* everything in between runs without leaving the loop. HALT returns to the
+* caller at the next scheduled event, nothing inside the loop can wake it.
+* An unused opcode stops the loop with -1, like cpu_step.
+*/
+#if defined(__GNUC__) && !defined(BOYC_NO_COMPUTED_GOTO)
+#define CPU_COMPUTED_GOTO 1
+#endif
+
+int8_t cpu_run(cpu_t *cpu, mem_t *m, uint64_t cycle_budget)
+{
+    const uint64_t end = cpu->cycles + cycle_budget;
+    uint8_t *events = mem_events(m);
+    cpu_decoded_t scratch;
+    const cpu_decoded_t *d;
+
+    cpu->run_end = end;
+
+    while (cpu->cycles < end) {
+        if (cpu_interrupt(cpu, m)) {
+            continue;
+        }
+        if (cpu->halted) {
+            cpu_idle(cpu, end);
+            break;
+        }
+        *events = 0;
+        cpu_icache_check_map(cpu->icache, m);
+        const uint8_t ime = cpu->ime;
+        const int locked = mem_dma_active(m);   /* an FF46 write raises MEM_EV_DMA */
+
+#define RUN_CONTINUE() \
+    (cpu->cycles < end && !*events && cpu->ime == ime && !cpu->halted)
+
+#ifdef CPU_COMPUTED_GOTO
+#define OP_LABEL_ADDR(opcode, fn) &&lbl_##opcode,
+#define OP_LABEL(opcode, fn) \
+    lbl_##opcode: \
+        if (fn == op_illegal) goto illegal; \
+        cpu->cycles += fn(cpu, m); \
+        DISPATCH();
+#define FUSE_LABEL_ADDR(n, first, second, first_fn, second_fn) &&lbl_fuse_##n,
+#define FUSE_LABEL(n, first, second, first_fn, second_fn) \
+    lbl_fuse_##n: \
+        cpu->cycles += first_fn(cpu, m); \
+        if (!RUN_CONTINUE()) goto leave; \
+        d += d->length; \
+        cpu->imm = d->imm; \
+        cpu->cycles += second_fn(cpu, m); \
+        DISPATCH();
+#define DISPATCH() \
+    do { \
+        if (!RUN_CONTINUE()) goto leave; \
+        d = cpu_fetch(cpu, m, &scratch, locked); \
+        cpu->imm = d->imm; \
+        goto *labels[d->slot]; \
+    } while (0)
+
+        static void *const labels[OPS_COUNT + FUSE_COUNT] = {
+            CPU_OP_LIST(OP_LABEL_ADDR)
+            CPU_FUSE_LIST(FUSE_LABEL_ADDR)
+        };
+
+        DISPATCH();
+        CPU_OP_LIST(OP_LABEL)
+        CPU_FUSE_LIST(FUSE_LABEL)
+leave:
+        ;
+#undef DISPATCH
+#undef FUSE_LABEL
+#undef FUSE_LABEL_ADDR
+#undef OP_LABEL
+#undef OP_LABEL_ADDR
+#else
+#define OP_CASE(opcode, fn) \
+    case opcode: \
+        if (fn == op_illegal) goto illegal; \
+        cpu->cycles += fn(cpu, m); \
+        break;
+#define FUSE_CASE(n, first, second, first_fn, second_fn) \
+    case OPS_COUNT + n: \
+        cpu->cycles += first_fn(cpu, m); \
+        if (!RUN_CONTINUE()) break; \
+        d += d->length; \
+        cpu->imm = d->imm; \
+        cpu->cycles += second_fn(cpu, m); \
+        break;
+
+        while (RUN_CONTINUE()) {
+            d = cpu_fetch(cpu, m, &scratch, locked);
+            cpu->imm = d->imm;
+            switch (d->slot) {
+                CPU_OP_LIST(OP_CASE)
+                CPU_FUSE_LIST(FUSE_CASE)
+            }
+        }
+#undef FUSE_CASE
+#undef OP_CASE
+#endif
+#undef RUN_CONTINUE
+    }
+
+    cpu_flags_sync(cpu);
+    cpu->run_end = UINT64_MAX;
+    return 0;
+
+illegal:
+    op_illegal(cpu, m);
+    cpu_flags_sync(cpu);
+    cpu->run_end = UINT64_MAX;
+    return -1;
+}
@@ -48,19 +48,154 @@ static inline int cpu_get_flag(const cpu_regs_t *r, uint8_t mask)
     return (r->f & mask) != 0;
 }
 
+typedef struct cpu_icache cpu_icache_t;   /* decoded-instruction cache */
+
+/*
+ * Lazy flags (BOYC_LAZY_FLAGS builds): ALU ops only record their result,
+ * carry and operands, F is assembled when something actually reads it.
+ * Z and C come straight from the record, N and H need the op kind.
+ * Without BOYC_LAZY_FLAGS the same record is written back to F at once.
+ */
+enum {
+    CPU_LF_NONE = 0,   /* r.f is up to date */
+    CPU_LF_ADD,        /* ADD/ADC: a + b + cin */
+    CPU_LF_SUB,        /* SUB/SBC/CP: a - b - cin */
+    CPU_LF_AND,        /* AND, BIT (H set) */
+    CPU_LF_OR,         /* OR, XOR, CB rotates/shifts/SWAP (N, H clear) */
+    CPU_LF_INC,        /* INC r/(HL), a is the old value */
+    CPU_LF_DEC         /* DEC r/(HL), a is the old value */
+};
+
+typedef struct {
+    uint8_t kind;      /* CPU_LF_* */
+    uint8_t res;       /* 8-bit result, Z = (res == 0) */
+    uint8_t c;         /* C as 0/1 */
+    uint8_t a, b, cin; /* operands for H */
+} cpu_lazy_flags_t;
+
+static inline uint8_t cpu_flags_eval(const cpu_lazy_flags_t *lf, uint8_t f)
+{
+    uint8_t zc = ((lf->res == 0) ? F_Z : 0) | (lf->c ? F_C : 0);
+
+    switch (lf->kind)
+    {
+        case CPU_LF_ADD:
+            return zc
+                | ((((lf->a & 0x0F) + (lf->b & 0x0F) + lf->cin) > 0x0F) ? F_H : 0);
+        case CPU_LF_SUB:
+            return zc | F_N
+                | (((lf->a & 0x0F) < (lf->b & 0x0F) + lf->cin) ? F_H : 0);
+        case CPU_LF_AND:
+            return zc | F_H;
+        case CPU_LF_OR:
+            return zc;
+        case CPU_LF_INC:
+            return zc | (((lf->a & 0x0F) == 0x0F) ? F_H : 0);
+        case CPU_LF_DEC:
+            return zc | F_N | (((lf->a & 0x0F) == 0) ? F_H : 0);
+        default:
+            return f;
+    }
+}
+
+/* Idle-loop detector: short backward JR loops that only poll STAT or LY
+ * are fast-forwarded to event_at, see cpu_idle_loop() */
+typedef struct {
+    uint8_t     enabled;  /* toggle, off after cpu_reset() */
+    uint8_t     ok;       /* watched loop only polls I/O */
+    uint16_t    pc;       /* JR of the watched loop */
+    uint16_t    bank;     /* ROM bank the loop lives in */
+    uint64_t    last;     /* cycle stamp of the previous iteration */
+    uint64_t    period;   /* cycles per iteration */
+    uint64_t    skips;    /* number of fast-forwards */
+    uint64_t    skipped;  /* cycles fast-forwarded */
+} cpu_idle_loop_t;
+
 typedef struct {
     cpu_regs_t   r;      /* all eight CPU registers, via the union we discussed */
     uint16_t    pc;      /* program counter */
     uint16_t    sp;      /* stack pointer */
     uint8_t     ime;     /* master-interrupt enable flip-flop (0/1) */
+    uint8_t     halted;  /* set by HALT, cleared once IE & IF is non-zero */
     uint64_t    cycles;  /* running machine-cycle counter */
+    uint16_t    imm;     /* operand bytes (d8/s8/d16/a16) of the current opcode */
+    cpu_icache_t *icache; /* optional, see cpu_icache_create() */
+    cpu_lazy_flags_t lf; /* pending flag update, see cpu_flags_sync() */
+    uint64_t    event_at; /* cycle of the next scheduled event (PPU, ...), set by
+                             the host so a halted cpu can skip ahead to it */
+    cpu_idle_loop_t idleloop;
+    uint64_t    run_end;  /* end of the current cpu_run/cpu_jit_run budget, idle-loop
+                             skips stop there (UINT64_MAX outside of a run) */
     /* …anything else you track (halt flag, speed switch, etc.) … */
 } cpu_t;
 
+/* F including any pending lazy update, does not modify the cpu */
+static inline uint8_t cpu_flags_value(const cpu_t *c)
+{
+#ifdef BOYC_LAZY_FLAGS
+    return cpu_flags_eval(&c->lf, c->r.f);
+#else
+    return c->r.f;
+#endif
+}
+
+/* Single flag test for conditional ops */
+static inline int cpu_flag(const cpu_t *c, uint8_t mask)
+{
+#ifdef BOYC_LAZY_FLAGS
+    if (c->lf.kind != CPU_LF_NONE) {
+        if (mask == F_Z) return c->lf.res == 0;
+        if (mask == F_C) return c->lf.c;
+    }
+#endif
+    return (cpu_flags_value(c) & mask) != 0;
+}
+
+/* Write a pending lazy update back to r.f, needed before r.f is used directly */
+static inline void cpu_flags_sync(cpu_t *c)
+{
+#ifdef BOYC_LAZY_FLAGS
+    if (c->lf.kind != CPU_LF_NONE) {
+        c->r.f = cpu_flags_eval(&c->lf, c->r.f);
+        c->lf.kind = CPU_LF_NONE;
+    }
+#else
+    (void)c;
+#endif
+}
+
+/* Record the flags of an ALU op, carry is the new C (0/1) */
+static inline void cpu_flags_record(cpu_t *c, uint8_t kind, uint8_t res,
+                                    uint8_t carry, uint8_t a, uint8_t b,
+                                    uint8_t cin)
+{
+#ifdef BOYC_LAZY_FLAGS
+    c->lf.kind = kind;
+    c->lf.res  = res;
+    c->lf.c    = carry;
+    c->lf.a    = a;
+    c->lf.b    = b;
+    c->lf.cin  = cin;
+#else
+    cpu_lazy_flags_t lf = { kind, res, carry, a, b, cin };
+    c->r.f = cpu_flags_eval(&lf, c->r.f);
+#endif
+}
+
 // Function prototypes
 void cpu_reset(cpu_t *cpu);
 void cpu_dump(const cpu_t *c);
 int8_t cpu_step(cpu_t *c, mem_t *m);
+int8_t cpu_run(cpu_t *c, mem_t *m, uint64_t cycle_budget);
+int cpu_service_interrupt(cpu_t *c, mem_t *m); /* 1 if an interrupt was taken */
+void cpu_idle(cpu_t *c, uint64_t limit); /* halted: skip to event_at, at most limit */
+void cpu_idle_loop(cpu_t *c, mem_t *m, uint16_t branch_pc); /* taken backward JR */
+
+/* Decoded-instruction cache for ROM code, attach with c->icache = ... after
+ * cpu_reset(). One cache per cpu. */
+cpu_icache_t *cpu_icache_create(void);
+void cpu_icache_destroy(cpu_icache_t *ic);
+void cpu_icache_fuse(cpu_icache_t *ic, int on); /* superinstructions in cpu_run */
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "cpu_jit.h"
+#include "cpu_ops.h"
+
+#if !defined(__x86_64__)
+#error "cpu_jit.cpp emits x86-64 code, build without BOYC_JIT on this target"
+#endif
+
+#define JIT_ARENA_SIZE      (4 * 1024 * 1024)
+#define JIT_TABLE_SIZE      (8192)               /* power of two */
+#define JIT_TABLE_MASK      (JIT_TABLE_SIZE - 1)
+#define JIT_MAX_BLOCKS      (JIT_TABLE_SIZE / 2) /* keep the probe chains short */
+#define JIT_MAX_INSNS       (64)
+#define JIT_MAX_INSN_BYTES  (80)                 /* largest emitted sequence */
+#define JIT_BLOCK_BYTES     (JIT_MAX_INSNS * JIT_MAX_INSN_BYTES + 64)
+#define JIT_EMPTY           (0xFFFFFFFFu)
+
+/* Translated block: returns the machine cycles it executed */
+typedef uint32_t (*jit_block_fn)(cpu_t *cpu, mem_t *m);
+
+typedef struct {
+    uint32_t     key;        /* rom/ram bank << 16 | pc, JIT_EMPTY if unused */
+    uint8_t      first_page; /* guest pages covered by the block */
+    uint8_t      last_page;
+    jit_block_fn code;       /* NULL once invalidated */
+} jit_block_t;
+
+struct cpu_jit {
+    mem_t          *mem;
+    uint8_t        *arena;
+    size_t          used;
+    uint32_t        block_count;
+    uint16_t        watch_gen;  /* mem_code_map() >> 16 the blocks were compiled with */
+    cpu_jit_stats_t stats;
+    jit_block_t     table[JIT_TABLE_SIZE];
+};
+
+#define OP_HANDLER(opcode, fn) fn,
+
+static const cpu_op_fn op_handlers[OPS_COUNT] = {
+    CPU_OP_LIST(OP_HANDLER)
+};
+
+/*
+* Guest state offsets (all fit into a disp8)
+*/
+#define CPU_OFF(field) ((uint8_t)offsetof(cpu_t, field))
+
+/* r8 encoding of the opcode table: B, C, D, E, H, L, (HL), A */
+static const uint8_t reg8_off[8] = {
+    CPU_OFF(r.b), CPU_OFF(r.c), CPU_OFF(r.d), CPU_OFF(r.e),
+    CPU_OFF(r.h), CPU_OFF(r.l), 0xFF, CPU_OFF(r.a)
+};
+
+/* rr encoding of the opcode table: BC, DE, HL, SP */
+static const uint8_t reg16_off[4] = {
+    CPU_OFF(r.bc), CPU_OFF(r.de), CPU_OFF(r.hl), CPU_OFF(sp)
+};
+
+/*
+* x86-64 emitter. Register use inside a block:
+*   rbx = cpu_t *, r12 = mem_t *, r13d = cycles executed so far
+*/
+typedef struct {
+    uint8_t *p;
+} jit_emit_t;
+
+static void emit8(jit_emit_t *e, uint8_t b)
+{
+    *e->p++ = b;
+}
+
+static void emit16(jit_emit_t *e, uint16_t v)
+{
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+static void emit32(jit_emit_t *e, uint32_t v)
+{
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+static void emit64(jit_emit_t *e, uint64_t v)
+{
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+static void emit_prologue(jit_emit_t *e)
+{
+    emit8(e, 0x53);                                    /* push rbx       */
+    emit8(e, 0x41); emit8(e, 0x54);                    /* push r12       */
+    emit8(e, 0x41); emit8(e, 0x55);                    /* push r13       */
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);    /* mov rbx, rdi   */
+    emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xF4);    /* mov r12, rsi   */
+    emit8(e, 0x45); emit8(e, 0x31); emit8(e, 0xED);    /* xor r13d, r13d */
+}
+
+static void emit_epilogue(jit_emit_t *e)
+{
+    emit8(e, 0x44); emit8(e, 0x89); emit8(e, 0xE8);    /* mov eax, r13d  */
+    emit8(e, 0x41); emit8(e, 0x5D);                    /* pop r13        */
+    emit8(e, 0x41); emit8(e, 0x5C);                    /* pop r12        */
+    emit8(e, 0x5B);                                    /* pop rbx        */
+    emit8(e, 0xC3);                                    /* ret            */
+}
+
+/* add r13d, imm32 */
+static void emit_add_cycles(jit_emit_t *e, uint32_t cycles)
+{
+    if (cycles == 0) {
+        return;
+    }
+    emit8(e, 0x41); emit8(e, 0x81); emit8(e, 0xC5);
+    emit32(e, cycles);
+}
+
+/* mov word [rbx + off], imm16 */
+static void emit_store16(jit_emit_t *e, uint8_t off, uint16_t value)
+{
+    emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x43); emit8(e, off);
+    emit16(e, value);
+}
+
+/* mov byte [rbx + off], imm8 */
+static void emit_store8(jit_emit_t *e, uint8_t off, uint8_t value)
+{
+    emit8(e, 0xC6); emit8(e, 0x43); emit8(e, off);
+    emit8(e, value);
+}
+
+/* movzx eax, byte [rbx + src] ; mov [rbx + dst], al */
+static void emit_move8(jit_emit_t *e, uint8_t dst, uint8_t src)
+{
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x43); emit8(e, src);
+    emit8(e, 0x88); emit8(e, 0x43); emit8(e, dst);
+}
+
+/* add/sub word [rbx + off], 1 */
+static void emit_step16(jit_emit_t *e, uint8_t off, int dec)
+{
+    emit8(e, 0x66); emit8(e, 0x83); emit8(e, dec ? 0x6B : 0x43); emit8(e, off);
+    emit8(e, 0x01);
+}
+
+/* handler(cpu, mem), cycles += result */
+static void emit_call(jit_emit_t *e, cpu_op_fn fn)
+{
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);    /* mov rdi, rbx   */
+    emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xE6);    /* mov rsi, r12   */
+    emit8(e, 0x48); emit8(e, 0xB8);                    /* mov rax, imm64 */
+    emit64(e, (uint64_t)(uintptr_t)fn);
+    emit8(e, 0xFF); emit8(e, 0xD0);                    /* call rax       */
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);    /* movzx eax, al  */
+    emit8(e, 0x41); emit8(e, 0x01); emit8(e, 0xC5);    /* add r13d, eax  */
+}
+
+/* cmp byte [events], 0 ; jne <exit>, returns the rel32 to patch */
+static uint8_t *emit_event_check(jit_emit_t *e, const uint8_t *events)
+{
+    emit8(e, 0x48); emit8(e, 0xB8);                    /* mov rax, imm64 */
+    emit64(e, (uint64_t)(uintptr_t)events);
+    emit8(e, 0x80); emit8(e, 0x38); emit8(e, 0x00);    /* cmp byte [rax], 0 */
+    emit8(e, 0x0F); emit8(e, 0x85);                    /* jne rel32      */
+    uint8_t *fixup = e->p;
+    emit32(e, 0);
+    return fixup;
+}
+
+/*
+* Guest side helpers
+*/
+enum {
+    REGION_ROM0,
+    REGION_ROMX,
+    REGION_ERAM,     /* cartridge RAM, keyed by its bank like ROMX */
+    REGION_RAM,
+    REGION_NONE      /* OAM, I/O, IE: never translated */
+};
+
+static int jit_region(uint16_t adr)
+{
+    if (adr < 0x4000) return REGION_ROM0;
+    if (adr < 0x8000) return REGION_ROMX;
+    if (adr >= 0xA000 && adr < 0xC000) return REGION_ERAM;
+    if (adr < 0xFE00) return REGION_RAM;
+    if (adr >= 0xFF80 && adr < 0xFFFF) return REGION_RAM;
+    return REGION_NONE;
+}
+
+/* The other address of a WRAM page: C000-DDFF and E000-FDFF are the same
+ * memory, -1 for pages without an echo */
+static int jit_echo_page(int page)
+{
+    if ((page >= 0xC0 && page <= 0xDD) || (page >= 0xE0 && page <= 0xFD)) {
+        return page ^ 0x20;
+    }
+    return -1;
+}
+
+static int jit_is_terminator(uint8_t op)
+{
+    switch (op) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:  /* JR       */
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:  /* JP       */
+        case 0xE9:                                              /* JP (HL)  */
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:  /* CALL     */
+        case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:  /* RET      */
+        case 0xD9:                                              /* RETI     */
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF:             /* RST      */
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        case 0x76: case 0x10:                                   /* HALT/STOP*/
+        case 0xF3: case 0xFB:                                   /* DI/EI    */
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t jit_key(mem_t *m, uint16_t pc)
+{
+    uint32_t bank = 0;
+
+    switch (jit_region(pc)) {
+        case REGION_ROM0: bank = mem_rom_bank0(m); break;
+        case REGION_ROMX: bank = mem_rom_bank(m);  break;
+        case REGION_ERAM: bank = mem_ram_bank(m);  break;
+        default:          break;
+    }
+    return (bank << 16) | pc;
+}
+
+static jit_block_t *jit_slot(cpu_jit_t *j, uint32_t key)
+{
+    uint32_t h = (key * 2654435761u) >> 19;
+    while (j->table[h & JIT_TABLE_MASK].key != JIT_EMPTY &&
+           j->table[h & JIT_TABLE_MASK].key != key) {
+        ++h;
+    }
+    return &j->table[h & JIT_TABLE_MASK];
+}
+
+/*
+* Translate the block starting at pc into the arena, the caller makes sure
+* JIT_BLOCK_BYTES are free. Returns NULL if pc is not translatable.
+*/
+static jit_block_fn jit_compile(cpu_jit_t *j, mem_t *m, uint16_t pc, jit_block_t *blk)
+{
+    const int region = jit_region(pc);
+    if (region == REGION_NONE ||
+        (region == REGION_ERAM && mem_ram_bank(m) == MEM_RAM_UNMAPPED)) {
+        return NULL;
+    }
+
+    uint8_t *start = j->arena + j->used;
+    jit_emit_t e = { start };
+    uint8_t *exits[JIT_MAX_INSNS];
+    int exit_count = 0;
+    uint32_t pending = 0;   /* cycles of native instructions not yet added */
+    int pc_synced = 1;      /* cpu->pc holds the current guest pc */
+    const uint8_t *events = mem_events(m);
+    const uint16_t block_pc = pc;
+    int insns = 0;
+    uint16_t last_pc = pc;
+
+    emit_prologue(&e);
+
+    for (insns = 0; insns < JIT_MAX_INSNS; ++insns) {
+        if (insns && !mem_fetch_cacheable(m, pc)) {
+            break;              /* exec watchpoint: leave it to cpu_step */
+        }
+        uint8_t op = mem_peek_byte(m, pc);
+        uint8_t len = op_length[op];
+        uint16_t next = pc + len;
+
+        if (op_handlers[op] == op_illegal) {
+            break;              /* cpu_step reports it and stops the run */
+        }
+
+        /* All bytes of the instruction must stay inside the block's region */
+        if (next < pc || jit_region(pc) != region ||
+            jit_region(pc + len - 1) != region) {
+            break;
+        }
+        last_pc = pc + len - 1;
+
+        uint8_t x = op >> 6;
+        uint8_t y = (op >> 3) & 0x07;
+        uint8_t z = op & 0x07;
+        int native = 1;
+
+        if (op == 0x00) {                                    /* NOP        */
+            pending += 1;
+        } else if (x == 1 && y != 6 && z != 6) {             /* LD r, r'   */
+            if (y != z) {
+                emit_move8(&e, reg8_off[y], reg8_off[z]);
+            }
+            pending += 1;
+        } else if (x == 0 && z == 6 && y != 6) {             /* LD r, d8   */
+            emit_store8(&e, reg8_off[y], mem_peek_byte(m, pc + 1));
+            pending += 2;
+        } else if (x == 0 && (op & 0x0F) == 0x01) {          /* LD rr, d16 */
+            emit_store16(&e, reg16_off[op >> 4], mem_peek_word(m, pc + 1));
+            pending += 3;
+        } else if (x == 0 && (op & 0x0F) == 0x03) {          /* INC rr     */
+            emit_step16(&e, reg16_off[op >> 4], 0);
+            pending += 2;
+        } else if (x == 0 && (op & 0x0F) == 0x0B) {          /* DEC rr     */
+            emit_step16(&e, reg16_off[op >> 4], 1);
+            pending += 2;
+        } else if (op == 0xC3) {                             /* JP a16     */
+            next = mem_peek_word(m, pc + 1);
+            pending += 4;
+        } else if (op == 0x18) {                             /* JR s8      */
+            int8_t s8 = (int8_t)mem_peek_byte(m, pc + 1);
+            next = (uint16_t)((int32_t)(pc + 2) + s8);
+            pending += 3;
+        } else {
+            native = 0;
+        }
+
+        if (native) {
+            pc_synced = 0;
+        } else {
+            /* Handlers expect cpu->pc and the operand in cpu->imm */
+            if (!pc_synced) {
+                emit_store16(&e, CPU_OFF(pc), pc);
+            }
+            if (len == 2) {
+                emit_store16(&e, CPU_OFF(imm), mem_peek_byte(m, pc + 1));
+            } else if (len == 3) {
+                emit_store16(&e, CPU_OFF(imm), mem_peek_word(m, pc + 1));
+            }
+            emit_add_cycles(&e, pending);
+            pending = 0;
+            emit_call(&e, op_handlers[op]);
+            pc_synced = 1;
+            if (!jit_is_terminator(op)) {
+                exits[exit_count++] = emit_event_check(&e, events);
+            }
+        }
+
+        pc = next;
+        if (jit_is_terminator(op)) {
+            ++insns;
+            break;
+        }
+    }
+
+    if (insns == 0) {
+        return NULL;   /* first instruction already leaves the region */
+    }
+
+    if (!pc_synced) {
+        emit_store16(&e, CPU_OFF(pc), pc);
+    }
+    emit_add_cycles(&e, pending);
+
+    uint8_t *exit = e.p;
+    emit_epilogue(&e);
+    for (int i = 0; i < exit_count; ++i) {
+        int32_t rel = (int32_t)(exit - (exits[i] + 4));
+        memcpy(exits[i], &rel, sizeof(rel));
+    }
+
+    blk->first_page = block_pc >> 8;
+    blk->last_page = (uint8_t)(last_pc >> 8);
+    if (region == REGION_RAM || region == REGION_ERAM) {
+        /* a store through the echo must find the block as well */
+        for (int page = blk->first_page; page <= blk->last_page; ++page) {
+            mem_mark_code_page(m, (uint8_t)page, 1);
+            if (jit_echo_page(page) >= 0) {
+                mem_mark_code_page(m, (uint8_t)jit_echo_page(page), 1);
+            }
+        }
+    }
+
+    j->used += (size_t)(e.p - start);
+    j->used = (j->used + 15) & ~(size_t)15;
+    j->stats.blocks_compiled++;
+    return (jit_block_fn)(void *)start;
+}
+
+static jit_block_fn jit_lookup(cpu_jit_t *j, mem_t *m, uint16_t pc)
+{
+    uint32_t key = jit_key(m, pc);
+    jit_block_t *blk = jit_slot(j, key);
+
+    if (!mem_fetch_cacheable(m, pc)) {
+        return NULL;    /* OAM DMA owns the bus or an exec watchpoint is set */
+    }
+    if (blk->key == key && blk->code) {
+        return blk->code;
+    }
+    if (j->used + JIT_BLOCK_BYTES > JIT_ARENA_SIZE ||
+        (blk->key != key && j->block_count >= JIT_MAX_BLOCKS)) {
+        /* out of space, start over */
+        cpu_jit_flush(j);
+        blk = jit_slot(j, key);
+    }
+
+    jit_block_fn code = jit_compile(j, m, pc, blk);
+    if (!code) {
+        return NULL;
+    }
+
+    if (blk->key != key) {
+        blk->key = key;
+        j->block_count++;
+    }
+    blk->code = code;
+    return code;
+}
+
+/* Bus hook: a page with translated code is about to be written, blocks
+ * built under its echo address go as well */
+static void jit_code_write(void *ctx, uint16_t adr)
+{
+    cpu_jit_t *j = (cpu_jit_t *)ctx;
+    const int page = adr >> 8;
+    const int echo = jit_echo_page(page);
+
+    for (int i = 0; i < JIT_TABLE_SIZE; ++i) {
+        jit_block_t *blk = &j->table[i];
+        if (blk->key != JIT_EMPTY && blk->code &&
+            ((blk->first_page <= page && page <= blk->last_page) ||
+             (blk->first_page <= echo && echo <= blk->last_page))) {
+            blk->code = NULL;
+            j->stats.blocks_invalidated++;
+        }
+    }
+    mem_mark_code_page(j->mem, (uint8_t)page, 0);
+    if (echo >= 0) {
+        mem_mark_code_page(j->mem, (uint8_t)echo, 0);
+    }
+}
+
+/*
+* Public interface
+*/
+cpu_jit_t *cpu_jit_create(mem_t *m)
+{
+    cpu_jit_t *j = (cpu_jit_t *)calloc(1, sizeof(cpu_jit_t));
+    if (!j) {
+        return NULL;
+    }
+
+    void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        fprintf(stderr, "JIT: failed to map code arena\n");
+        free(j);
+        return NULL;
+    }
+
+    j->mem = m;
+    j->arena = (uint8_t *)arena;
+    for (int i = 0; i < JIT_TABLE_SIZE; ++i) {
+        j->table[i].key = JIT_EMPTY;
+    }
+    mem_set_code_hook(m, jit_code_write, j);
+    return j;
+}
+
+void cpu_jit_destroy(cpu_jit_t *j)
+{
+    if (!j) {
+        return;
+    }
+    mem_set_code_hook(j->mem, NULL, NULL);
+    munmap(j->arena, JIT_ARENA_SIZE);
+    free(j);
+}
+
+void cpu_jit_flush(cpu_jit_t *j)
+{
+    for (int i = 0; i < JIT_TABLE_SIZE; ++i) {
+        j->table[i].key = JIT_EMPTY;
+        j->table[i].code = NULL;
+    }
+    for (int page = 0; page < 256; ++page) {
+        mem_mark_code_page(j->mem, (uint8_t)page, 0);
+    }
+    j->used = 0;
+    j->block_count = 0;
+    j->stats.flushes++;
+}
+
+int8_t cpu_jit_run(cpu_jit_t *j, cpu_t *cpu, mem_t *m, uint64_t cycle_budget)
+{
+    const uint64_t end = cpu->cycles + cycle_budget;
+    uint8_t *events = mem_events(m);
+
+    cpu->run_end = end;
+
+    if (j->watch_gen != (uint16_t)(mem_code_map(m) >> 16)) {
+        cpu_jit_flush(j);       /* blocks may cover newly exec-watched code */
+        j->watch_gen = (uint16_t)(mem_code_map(m) >> 16);
+    }
+
+    while (cpu->cycles < end) {
+        if (cpu_service_interrupt(cpu, m)) {
+            continue;
+        }
+        if (cpu->halted) {
+            cpu_idle(cpu, end);
+            break;
+        }
+        *events = 0;
+
+        jit_block_fn code = jit_lookup(j, m, cpu->pc);
+        if (code) {
+            cpu->cycles += code(cpu, m);
+        } else {
+            j->stats.interpreted++;
+            if (cpu_step(cpu, m) != 0) {
+                cpu->run_end = UINT64_MAX;
+                return -1;
+            }
+        }
+    }
+
+    cpu_flags_sync(cpu);
+    cpu->run_end = UINT64_MAX;
+    return 0;
+}
+
+const cpu_jit_stats_t *cpu_jit_stats(const cpu_jit_t *j)
+{
+    return &j->stats;
+}
@@ -0,0 +1,42 @@
+#ifndef CPU_JIT_H
+#define CPU_JIT_H
+
+/**
+ * Basic-block recompiler for the gb cpu (x86-64 only, BOYC_JIT builds)
+ *
+ * Guest code is translated one basic block at a time, a block ends at the
+ * first jump/call/RET/RST (or EI/DI/HALT/STOP). Simple loads are emitted as
+ * native code, everything else calls the op_* handlers from cpu_ops.h.
+ * Blocks are keyed by (ROM or cartridge RAM bank, PC), so bank switches
+ * never run stale code, and a write to a RAM page holding translated code
+ * drops its blocks.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "cpu.h"
+#include "mem.h"
+
+typedef struct cpu_jit cpu_jit_t;
+
+/* Statistics, mainly for tests and benchmarks */
+typedef struct {
+    uint64_t blocks_compiled;
+    uint64_t blocks_invalidated;
+    uint64_t flushes;
+    uint64_t interpreted;      /* instructions run through cpu_step */
+} cpu_jit_stats_t;
+
+cpu_jit_t *cpu_jit_create(mem_t *m);
+void cpu_jit_destroy(cpu_jit_t *j);
+void cpu_jit_flush(cpu_jit_t *j);
+int8_t cpu_jit_run(cpu_jit_t *j, cpu_t *c, mem_t *m, uint64_t cycle_budget);
+const cpu_jit_stats_t *cpu_jit_stats(const cpu_jit_t *j);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CPU_JIT_H
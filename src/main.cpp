@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <SDL.h>
 #include "cpu.h"
 #include "mem.h"
 #include "rom.h"
+#include "sav.h"
 #include "display.h"
 #include "ppu.h"
 #include <SDL.h>
@@ -13,37 +15,93 @@ int quit = 0;
 int main(int argc, char const *argv[])
 {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <rom file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <rom file> [rom database]\n", argv[0]);
         return 1;
     }
 
-    const size_t cart_size = 0x200000; /* 2MB upper limit */
-    uint8_t *cart_image = (uint8_t *)malloc(cart_size);
-    if (!cart_image) {
-        fprintf(stderr, "Failed to allocate ROM buffer\n");
+    rom_t cart;
+    if (rom_map(argv[1], &cart) != 0) {
         return 1;
     }
 
-    if (load_rom(argv[1], cart_image, cart_size) != 0) {
-        free(cart_image);
+    rom_header_t header;
+    if (rom_parse_header(cart.data, cart.size, &header) != 0) {
+        fprintf(stderr, "%s is too small for a cartridge header\n", argv[1]);
+        rom_unmap(&cart);
         return 1;
     }
+    if (argc > 2) {
+        rom_db_t *db = rom_db_load(argv[2]);
+        if (db && rom_db_apply(db, &cart, &header)) {
+            printf("ROM database entry applied\n");
+        }
+        rom_db_free(db);
+    }
+    printf("%s: type %02X, %zu KB RAM\n", header.title, header.cart_type,
+           header.cart.ram_size / 1024);
+    if (!header.header_ok) {
+        printf("Warning: header checksum mismatch\n");
+    }
+    if (!header.global_ok) {
+        printf("Warning: global checksum mismatch\n");
+    }
+    if (!header.supported) {
+        printf("Warning: cartridge type %02X is not supported, running without mapper\n",
+               header.cart_type);
+    }
 
-    mem_t *mem = mem_create(cart_image, cart_size);
+    /* Battery-backed RAM lives in <rom>.sav, flushed at most once a second */
+    sav_t sav = {};
+    sav.fd = -1;
+    if (header.cart.battery && header.cart.ram_size) {
+        char sav_path[1024];
+        sav_path_for(argv[1], sav_path, sizeof(sav_path));
+        if (sav_open(sav_path, header.cart.ram_size, &sav) == 0) {
+            sav_set_policy(&sav, SAV_SYNC_INTERVAL, 1000);
+            header.cart.ram = sav.data;
+        }
+    }
+
+    mem_t *mem = mem_create_cart(cart.data, cart.size, &header.cart);
     cpu_t cpu;
     cpu_reset(&cpu);
+    cpu.idleloop.enabled = 1;   /* skip busy-wait polling of LY/STAT */
     ppu_t ppu;
     uint32_t frame[160 * 144] = {0};
-    ppu_init(&ppu, frame);
+    ppu_init(&ppu, frame, mem);
 
     if (display_init(160, 144) != 0) {
         mem_reset(mem);
-        free(cart_image);
+        sav_close(&sav);
+        rom_unmap(&cart);
         return 1;
     }
 
+    time_t rtc_time = time(NULL);
+    uint64_t shown = 0;                 /* last frame handed to the display */
+
     while (!quit) {
+        uint64_t start_cycles = cpu.cycles;
+
+        cpu.event_at = cpu.cycles + ppu_cycles_to_event(&ppu);
+        cpu_step(&cpu, mem);             /* advance one instruction */
+
+        uint64_t delta = cpu.cycles - start_cycles;
+        ppu_step(&ppu, delta, mem);         /* keep PPU in lock-step   */
+        mem_step(mem, (uint32_t)delta);     /* and timed OAM DMA       */
+
+        if (ppu.frames == shown) {
+            continue;
+        }
+        shown = ppu.frames;             /* a frame completed: present it */
+
         SDL_Event e;
+        time_t now = time(NULL);
+
+        if (now > rtc_time) {               /* MBC3 clock follows the host */
+            mem_rtc_advance(mem, (uint32_t)(now - rtc_time));
+            rtc_time = now;
+        }
 
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) {
@@ -51,13 +109,8 @@ int main(int argc, char const *argv[])
             }
         }
 
-        uint64_t start_cycles = cpu.cycles;
-
-        cpu_step(&cpu, mem);             /* advance one instruction */
-
-        uint64_t delta = cpu.cycles - start_cycles;
-        ppu_step(&ppu, delta, mem);         /* keep PPU in lock-step   */
-        (void)delta; /* silence unused variable warning if not used */
+        mem_serial_flush(mem);
+        sav_tick(&sav, mem, SDL_GetTicks());
 
         display_render(frame);
         SDL_Delay(16);
@@ -68,7 +121,8 @@ int main(int argc, char const *argv[])
     ppu_reset(&ppu);
 
     mem_reset(mem);
-    free(cart_image);
+    sav_close(&sav);
+    rom_unmap(&cart);
     return 0;
 }
 
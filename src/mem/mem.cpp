@@ -3,116 +3,748 @@
 #include <stdio.h>
 #include "mem.h"
 
+#define MEM_SERIAL_BUF (4096)
+#define MEM_WATCH_MAX  (16)
+
+/* Watchpoint, see mem_watch_add() */
+typedef struct {
+    uint16_t     first;
+    uint16_t     last;
+    uint8_t      kinds;    /* MEM_WATCH_*, 0 if the slot is free */
+    mem_watch_fn fn;
+    void        *ctx;
+} mem_watch_t;
+
+/* Per-register I/O dispatch entry, see mem_io_register() */
+typedef struct {
+    mem_io_read_fn  read;
+    mem_io_write_fn write;
+    void           *ctx;
+} mem_io_handler_t;
+
 struct mem {
+    /* Page table, one entry per 256 byte page (addr >> 8). Plain ROM/RAM
+       pages point straight at their backing store, NULL sends the access
+       to the slow path (OAM, I/O, unmapped areas, MBC registers). rmap and
+       wmap are rpage and wpage minus the pages that must see every access
+       (code pages, watchpoints, ...), see mem_update_rmap/mem_update_wmap. */
+    const uint8_t *rmap[256];
+    uint8_t       *wmap[256];
+    const uint8_t *rpage[256];
+    uint8_t       *wpage[256];
+
     /* Fixed areas */
     uint8_t  wram[8 * 1024];
     uint8_t  vram[8 * 1024];
     uint8_t  hram[0x7F];
     uint8_t  oam [160];
-    uint8_t  eram[(7 * 1024) + 512];
     uint8_t  io[128];
+    mem_io_handler_t io_handlers[128]; /* FF00-FF7F dispatch */
     uint8_t  ie;
+    uint8_t  events;   /* MEM_EV_* */
+
+    /* Serial output ring buffer, see mem_serial_sink */
+    uint8_t  serial_buf[MEM_SERIAL_BUF];
+    size_t   serial_head;  /* oldest queued byte */
+    size_t   serial_len;
+    mem_serial_fn serial_fn;
+    void    *serial_ctx;
+
+    mem_dirty_t dirty; /* VRAM/OAM changes, see mem_dirty */
+
+    /* OAM DMA, see io_write_dma */
+    uint8_t  dma_mode;     /* MEM_DMA_* */
+    uint8_t  dma_lock;     /* timed transfer running, pages below FF00 unmapped */
+    uint8_t  dma_pos;      /* bytes copied to OAM so far */
+    uint32_t dma_clock;    /* M-cycles since the transfer started */
+    uint8_t  dma_buf[160]; /* source bytes, latched at the FF46 write */
+
+    /* Watchpoints, watch_pages[page] is the union of their MEM_WATCH_* */
+    mem_watch_t watches[MEM_WATCH_MAX];
+    uint8_t  watch_pages[256];
+    uint16_t watch_gen;    /* bumped when the exec-watched pages change */
+    const uint16_t *watch_pc;
+
+    /* Pages (addr >> 8) holding translated code, see mem_mark_code_page */
+    uint8_t  code_pages[256];
+    mem_code_write_fn code_hook;
+    void    *code_ctx;
 
     /* Cartridge area */
     const uint8_t *rom;
     size_t         rom_size;
+    uint8_t       *eram;       /* external RAM, all banks */
+    size_t         eram_size;
+    uint8_t        eram_owned; /* allocated here, not supplied by mem_cart_t */
+    uint8_t        eram_track; /* write-protect ERAM until written, see mem_eram_dirty */
+    uint8_t        eram_dirty;
 
-    /* Mapper state (bank numbers, RTC latch, …) */
-    uint8_t  rom_bank;
-    uint8_t  ram_bank;
-    uint8_t  mbc_type;
-    /* … */
+    /* Mapper state */
+    uint8_t  mbc_type;     /* MEM_MBC_* */
+    uint16_t rom_banks;    /* 16K banks in the image */
+    uint16_t mapped_bank[2]; /* ROM bank at 0000-3FFF and at 4000-7FFF */
+    uint8_t  ram_bank;     /* 8K bank at A000-BFFF, on MBC3 08-0C select an RTC register */
+    uint16_t mapped_ram;   /* mem_ram_bank() as last mapped */
+    uint8_t  ram_enable;
+    uint8_t  bank_lo;      /* raw bank registers: MBC1 5+2 bits, MBC3 7 bits, */
+    uint8_t  bank_hi;      /* MBC5 8+1 bits */
+    uint8_t  bank_mode;    /* MBC1 banking mode */
 
-    /* Pointers to other subsystems if you want tight coupling
-       (PPU, APU, timers) for side-effects inside mem_rb/mem_wb */
+    /* MBC3 real-time clock: S, M, H, DL, DH, live and latched copy */
+    uint8_t  rtc[5];
+    uint8_t  rtc_latched[5];
+    uint8_t  rtc_latch;    /* last value written to 6000-7FFF */
+    uint8_t  rtc_present;
 };
 
-uint8_t mem_read_byte(mem_t *m, uint16_t adr)
+/* Fast read pointer: not while OAM DMA locks the bus, nor for watched pages */
+static inline void mem_update_rmap(mem_t *m, uint8_t page)
 {
-    switch (adr >> 12) { // high nibble of address
-        case 0x0 ... 0x3: // 0000–3FFF: Fixed ROM bank 0
-            return m->rom[adr];
-        case 0x4 ... 0x7: // 4000–7FFF: Switchable ROM bank
-            return m->rom[(m->rom_bank * 0x4000) + (adr & 0x3FFF)];
-        case 0x8 ... 0x9: // 8000–9FFF: VRAM
-            return m->vram[adr - 0x8000];
-        case 0xA ... 0xB: // A000–BFFF: External (cartridge) RAM
-            return m->eram[adr - 0xA000];
-        case 0xC:         // C000–CFFF: Work RAM bank 0
-            return m->wram[adr - 0xC000];
-        case 0xD:         // D000–DFFF: Work RAM bank 1
-            return m->wram[0x1000 + (adr - 0xD000)];
-        case 0xE:         // E000–EFFF: Echo RAM (mirror of C000–DDFF)
-            return m->wram[adr - 0xE000];
-        case 0xF:
-            if (adr < 0xFE00) { // F000–FDFF: Echo RAM continued
-                return m->wram[adr - 0xE000];
-            } else if (adr < 0xFEA0) { // FE00–FE9F: Sprite attribute table (OAM)
-                return m->oam[adr - 0xFE00];
-            } else if (adr < 0xFF00) { // FEA0–FEFF: Unusable memory
-                return 0xFF;
-            } else if (adr < 0xFF80) { // FF00–FF7F: I/O Registers
-                return m->io[adr - 0xFF00];
-            } else if (adr < 0xFFFF) { // FF80–FFFE: High RAM (HRAM)
-                return m->hram[adr - 0xFF80];
-            } else { // FFFF: Interrupt Enable Register
-                return m->ie;
-            }
-        default:
-            return 0xFF; // Open bus
+    const int watched = m->watch_pages[page] & (MEM_WATCH_READ | MEM_WATCH_EXEC);
+
+    m->rmap[page] = (watched || m->dma_lock) ? NULL : m->rpage[page];
+}
+
+/* Fast write pointer: not for code pages, VRAM (dirty tracking), watched
+ * pages, nor for clean tracked cartridge RAM */
+static inline void mem_update_wmap(mem_t *m, uint8_t page)
+{
+    const int clean_eram = m->eram_track && !m->eram_dirty && page >= 0xA0 && page < 0xC0;
+    const int vram = (page & 0xE0) == 0x80;
+    const int watched = m->watch_pages[page] & MEM_WATCH_WRITE;
+
+    m->wmap[page] = (m->code_pages[page] || vram || watched || clean_eram || m->dma_lock)
+                  ? NULL : m->wpage[page];
+}
+
+/* VRAM and OAM stores, recording what changed in m->dirty */
+static inline void mem_vram_write(mem_t *m, uint16_t off, uint8_t value)
+{
+    if (m->vram[off] == value) {
+        return;
+    }
+    m->vram[off] = value;
+    if (off < 0x1800) {
+        m->dirty.tiles[off >> 10] |= 1ull << ((off >> 4) & 63);
+    } else {
+        m->dirty.map_rows |= 1ull << ((off - 0x1800) >> 5);
     }
 }
 
-uint16_t mem_read_word(mem_t *m, uint16_t adr)
+static inline void mem_oam_write(mem_t *m, uint8_t off, uint8_t value)
 {
-    uint8_t low = mem_read_byte(m, adr);
-    uint8_t high = mem_read_byte(m, adr + 1);
+    if (m->oam[off] != value) {
+        m->oam[off] = value;
+        m->dirty.oam |= 1ull << (off >> 2);
+    }
+}
 
-    return (high << 8) | low;
+/* Point pages [first, first + count) at base, NULL leaves them to the slow path */
+static void mem_map_pages(mem_t *m, uint8_t first, uint8_t count,
+                          const uint8_t *rbase, uint8_t *wbase)
+{
+    for (int i = 0; i < count; ++i) {
+        const uint8_t page = first + i;
+        m->rpage[page] = rbase ? rbase + (i << 8) : NULL;
+        m->wpage[page] = wbase ? wbase + (i << 8) : NULL;
+        mem_update_rmap(m, page);
+        mem_update_wmap(m, page);
+    }
 }
 
-void mem_write_byte(mem_t *m, uint16_t adr, uint8_t value)
+/* ROM pages, anything past the end of the image reads through the slow path */
+static void mem_map_rom(mem_t *m, uint8_t first, size_t offset)
 {
-    switch (adr >> 12) {
-        case 0x8 ... 0x9: // 8000–9FFF: VRAM
-            m->vram[adr - 0x8000] = value;
+    for (int i = 0; i < 0x40; ++i) {
+        size_t at = offset + (i << 8);
+        mem_map_pages(m, first + i, 1, (at + 0x100 <= m->rom_size) ? m->rom + at : NULL, NULL);
+    }
+}
+
+/* Selected external RAM bank, unmapped while disabled or an RTC register is selected */
+static void mem_map_eram(mem_t *m)
+{
+    const uint16_t bank = mem_ram_bank(m);
+
+    if (bank != m->mapped_ram) {
+        m->mapped_ram = bank;
+        m->events |= MEM_EV_BANK;
+    }
+    mem_map_pages(m, 0xA0, 0x20, NULL, NULL);
+    if (bank == MEM_RAM_UNMAPPED) {
+        return;
+    }
+
+    size_t offset = ((size_t)m->ram_bank * 0x2000) % m->eram_size;
+    size_t size = m->eram_size - offset;
+    uint8_t count = (size < 0x2000) ? (uint8_t)(size >> 8) : 0x20;
+    mem_map_pages(m, 0xA0, count, m->eram + offset, m->eram + offset);
+}
+
+/* (Re)build the whole table */
+static void mem_map_update(mem_t *m)
+{
+    mem_map_rom(m, 0x00, (size_t)m->mapped_bank[0] * 0x4000); /* 0000–3FFF: ROM bank 0 */
+    mem_map_rom(m, 0x40, (size_t)m->mapped_bank[1] * 0x4000); /* 4000–7FFF: switchable */
+    mem_map_pages(m, 0x80, 0x20, m->vram, m->vram);         /* 8000–9FFF: VRAM       */
+    mem_map_eram(m);                                        /* A000–BFFF: ERAM       */
+    mem_map_pages(m, 0xC0, 0x20, m->wram, m->wram);         /* C000–DFFF: WRAM       */
+    mem_map_pages(m, 0xE0, 0x1E, m->wram, m->wram);         /* E000–FDFF: echo       */
+}
+
+/*
+* Mappers. Register writes only update the bank numbers, the page table is
+* rewritten for the areas that actually moved, so reads from a switched
+* bank cost the same as any other plain page.
+*/
+static void mem_mbc_update(mem_t *m)
+{
+    uint16_t rom_bank = 1;
+    uint16_t rom_bank0 = 0;
+    uint8_t  ram_bank = m->ram_bank;
+
+    switch (m->mbc_type) {
+        case MEM_MBC1:
+            rom_bank = (m->bank_hi << 5) | (m->bank_lo ? m->bank_lo : 1);
+            if (m->bank_mode) {
+                rom_bank0 = m->bank_hi << 5;
+                ram_bank = m->bank_hi;
+            } else {
+                ram_bank = 0;
+            }
             break;
-        case 0xA ... 0xB: // A000–BFFF: External (cartridge) RAM
-            m->eram[adr - 0xA000] = value;
+        case MEM_MBC3:
+            rom_bank = m->bank_lo ? m->bank_lo : 1;
             break;
-        case 0xC: // C000–CFFF: Work RAM bank 0
-            m->wram[adr - 0xC000] = value;
+        case MEM_MBC5:
+            rom_bank = (m->bank_hi << 8) | m->bank_lo;
             break;
-        case 0xD: // D000–DFFF: Work RAM bank 1
-            m->wram[0x1000 + (adr - 0xD000)] = value;
+        default:
             break;
-        case 0xE: // E000–EFFF: Echo RAM
-            m->wram[adr - 0xE000] = value;
+    }
+    rom_bank %= m->rom_banks;
+    rom_bank0 %= m->rom_banks;
+
+    if (rom_bank0 != m->mapped_bank[0]) {
+        mem_map_rom(m, 0x00, (size_t)rom_bank0 * 0x4000);
+        m->mapped_bank[0] = rom_bank0;
+        m->events |= MEM_EV_BANK;
+    }
+    if (rom_bank != m->mapped_bank[1]) {
+        mem_map_rom(m, 0x40, (size_t)rom_bank * 0x4000);
+        m->mapped_bank[1] = rom_bank;
+        m->events |= MEM_EV_BANK;
+    }
+    m->ram_bank = ram_bank;
+    mem_map_eram(m);
+}
+
+/* Writes to 0000–7FFF */
+static void mem_mbc_write(mem_t *m, uint16_t adr, uint8_t value)
+{
+    if (m->mbc_type == MEM_MBC_NONE) {
+        return;
+    }
+
+    switch (adr >> 13) {
+        case 0: // 0000–1FFF: RAM (and RTC) enable
+            m->ram_enable = (value & 0x0F) == 0x0A;
             break;
-        case 0xF:
-            if (adr < 0xFE00) { // F000–FDFF: Echo RAM continued
-                m->wram[adr - 0xE000] = value;
-            } else if (adr < 0xFEA0) { // FE00–FE9F: OAM
-                m->oam[adr - 0xFE00] = value;
-            } else if (adr < 0xFF00) {
-                /* unusable memory */
-            } else if (adr < 0xFF80) { // FF00–FF7F: I/O Registers
-                m->io[adr - 0xFF00] = value;
-                if (adr == 0xFF02 && value == 0x81) {
-                    uint8_t c = m->io[0x01];
-                    putchar(c);
-                    fflush(stdout);
+        case 1: // 2000–3FFF: ROM bank
+            if (m->mbc_type == MEM_MBC1) {
+                m->bank_lo = value & 0x1F;
+            } else if (m->mbc_type == MEM_MBC3) {
+                m->bank_lo = value & 0x7F;
+            } else if (adr < 0x3000) {
+                m->bank_lo = value;
+            } else {
+                m->bank_hi = value & 0x01;
+            }
+            break;
+        case 2: // 4000–5FFF: RAM bank / upper ROM bits / RTC register
+            if (m->mbc_type == MEM_MBC1) {
+                m->bank_hi = value & 0x03;
+            } else if (m->mbc_type == MEM_MBC3) {
+                if (value <= 0x03 || (value >= 0x08 && value <= 0x0C)) {
+                    m->ram_bank = value;
                 }
-            } else if (adr < 0xFFFF) { // FF80–FFFE: HRAM
-                m->hram[adr - 0xFF80] = value;
             } else {
-                m->ie = value;
+                m->ram_bank = value & 0x0F;
             }
             break;
-        default:
-            /* ignore writes to ROM or open bus */
+        case 3: // 6000–7FFF: MBC1 banking mode, MBC3 clock latch
+            if (m->mbc_type == MEM_MBC1) {
+                m->bank_mode = value & 0x01;
+            } else if (m->mbc_type == MEM_MBC3) {
+                if (m->rtc_latch == 0x00 && value == 0x01) {
+                    memcpy(m->rtc_latched, m->rtc, sizeof(m->rtc));
+                }
+                m->rtc_latch = value;
+            }
             break;
     }
+    mem_mbc_update(m);
+}
+
+void mem_rtc_advance(mem_t *m, uint32_t seconds)
+{
+    uint8_t *r = m->rtc;
+
+    if (r[4] & 0x40) {      // halted
+        return;
+    }
+
+    uint64_t day = ((r[4] & 0x01) << 8) | r[3];
+    uint64_t t = r[0] + 60ull * r[1] + 3600ull * r[2] + 86400ull * day + seconds;
+
+    r[0] = t % 60;
+    r[1] = (t / 60) % 60;
+    r[2] = (t / 3600) % 24;
+    day = t / 86400;
+    if (day > 0x1FF) {
+        r[4] |= 0x80;       // day counter carry, sticky until written
+        day &= 0x1FF;
+    }
+    r[3] = day & 0xFF;
+    r[4] = (r[4] & 0xFE) | (uint8_t)(day >> 8);
+}
+
+/*
+* OAM DMA. The 160 source bytes are fetched at the FF46 write: while a
+* timed transfer runs the cpu cannot write anything the DMA reads, so the
+* copy out of dma_buf matches the hardware byte for byte. Locking unmaps
+* every page below FF00, the slow path then returns FF.
+*/
+static uint8_t mem_read_slow(mem_t *m, uint16_t adr, uint8_t kind);
+
+static void mem_dma_fetch(mem_t *m, uint16_t src, uint8_t *dst)
+{
+    const uint8_t *page = m->rpage[src >> 8];
+
+    if (page) {
+        memcpy(dst, page, 160);
+        return;
+    }
+    for (int i = 0; i < 160; ++i) {
+        dst[i] = mem_read_slow(m, src + i, 0);
+    }
+}
+
+static void mem_dma_lock(mem_t *m, int on)
+{
+    m->dma_lock = on ? 1 : 0;
+    if (on) {
+        m->events |= MEM_EV_DMA;        // nothing decoded may run past this
+    }
+    mem_map_update(m);
+}
+
+static void mem_dma_copy(mem_t *m, uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; ++i) {
+        mem_oam_write(m, (uint8_t)i, m->dma_buf[i]);
+    }
+}
+
+/* FF46 DMA: source XX00-XX9F, E0-FF read the WRAM echo */
+static void io_write_dma(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    uint16_t src = value << 8;
+
+    (void)ctx;
+    m->io[reg] = value;
+    if (src >= 0xE000) {
+        src -= 0x2000;
+    }
+    if (m->dma_lock) {              // restart: the new source is readable
+        mem_dma_lock(m, 0);
+    }
+    mem_dma_fetch(m, src, m->dma_buf);
+    if (m->dma_mode == MEM_DMA_INSTANT) {
+        mem_dma_copy(m, 0, 160);
+        return;
+    }
+    m->dma_pos = 0;
+    m->dma_clock = 0;
+    mem_dma_lock(m, 1);
+}
+
+void mem_step(mem_t *m, uint32_t cycles)
+{
+    if (!m->dma_lock) {
+        return;
+    }
+    m->dma_clock += cycles;
+
+    uint32_t end = m->dma_clock;        // one byte per M-cycle
+    if (end > 160) {
+        end = 160;
+    }
+    mem_dma_copy(m, m->dma_pos, end);
+    m->dma_pos = (uint8_t)end;
+    if (end == 160) {
+        mem_dma_lock(m, 0);
+    }
+}
+
+void mem_set_dma_mode(mem_t *m, int mode)
+{
+    m->dma_mode = (mode == MEM_DMA_INSTANT) ? MEM_DMA_INSTANT : MEM_DMA_TIMED;
+}
+
+int mem_dma_active(const mem_t *m)
+{
+    return m->dma_lock;
+}
+
+/*
+* I/O registers. Every register dispatches through io_handlers, the
+* defaults below just store the value, so side effects only cost
+* something on the registers that have them.
+*/
+static uint8_t io_read_plain(void *ctx, mem_t *m, uint8_t reg)
+{
+    (void)ctx;
+    return m->io[reg];
+}
+
+static void io_write_plain(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    (void)ctx;
+    m->io[reg] = value;
+}
+
+/*
+* Serial output. The ring buffer is drained from serial_head, at most two
+* contiguous runs per flush.
+*/
+static void serial_write_stdout(void *ctx, const uint8_t *data, size_t len)
+{
+    (void)ctx;
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+}
+
+void mem_serial_flush(mem_t *m)
+{
+    if (!m->serial_fn) {
+        return;                     // capture mode, kept for mem_serial_read
+    }
+    while (m->serial_len) {
+        size_t run = MEM_SERIAL_BUF - m->serial_head;
+        if (run > m->serial_len) {
+            run = m->serial_len;
+        }
+        m->serial_fn(m->serial_ctx, m->serial_buf + m->serial_head, run);
+        m->serial_head = (m->serial_head + run) % MEM_SERIAL_BUF;
+        m->serial_len -= run;
+    }
+    m->serial_head = 0;             // next batch is one contiguous run
+}
+
+void mem_serial_sink(mem_t *m, mem_serial_fn fn, void *ctx)
+{
+    mem_serial_flush(m);
+    m->serial_fn = fn;
+    m->serial_ctx = ctx;
+}
+
+size_t mem_serial_read(mem_t *m, uint8_t *out, size_t size)
+{
+    size_t n = 0;
+
+    while (n < size && m->serial_len) {
+        out[n++] = m->serial_buf[m->serial_head];
+        m->serial_head = (m->serial_head + 1) % MEM_SERIAL_BUF;
+        m->serial_len--;
+    }
+    return n;
+}
+
+static void serial_put(mem_t *m, uint8_t c)
+{
+    if (m->serial_len == MEM_SERIAL_BUF) {
+        if (m->serial_fn) {
+            mem_serial_flush(m);
+        } else {                    // capture: drop the oldest byte
+            m->serial_head = (m->serial_head + 1) % MEM_SERIAL_BUF;
+            m->serial_len--;
+        }
+    }
+    m->serial_buf[(m->serial_head + m->serial_len) % MEM_SERIAL_BUF] = c;
+    m->serial_len++;
+}
+
+/* FF02 SC: a transfer with the internal clock queues SB for the sink */
+static void io_write_sc(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    (void)ctx;
+    m->io[reg] = value;
+    if (value == 0x81) {
+        serial_put(m, m->io[0x01]);
+    }
+}
+
+/* FF0F IF: the cpu re-checks pending interrupts */
+static void io_write_if(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    (void)ctx;
+    m->io[reg] = value;
+    m->events |= MEM_EV_IRQ;
+}
+
+void mem_io_register(mem_t *m, uint8_t reg, mem_io_read_fn rd, mem_io_write_fn wr, void *ctx)
+{
+    mem_io_handler_t *h = &m->io_handlers[reg & 0x7F];
+
+    h->read = rd ? rd : io_read_plain;
+    h->write = wr ? wr : io_write_plain;
+    h->ctx = ctx;
+}
+
+uint8_t *mem_io_regs(mem_t *m)
+{
+    return m->io;
+}
+
+static void mem_io_init(mem_t *m)
+{
+    for (int reg = 0; reg < 0x80; ++reg) {
+        mem_io_register(m, (uint8_t)reg, NULL, NULL, NULL);
+    }
+    mem_io_register(m, 0x02, NULL, io_write_sc, NULL);
+    mem_io_register(m, 0x0F, NULL, io_write_if, NULL);
+    mem_io_register(m, 0x46, NULL, io_write_dma, NULL);
+}
+
+/*
+* Watchpoints. Watched pages are left out of rmap/wmap, so only accesses
+* to them reach the slow path and the checks below, every other page keeps
+* the plain pointer lookup.
+*/
+static void mem_watch_hit(mem_t *m, uint16_t adr, uint8_t value, uint8_t kind)
+{
+    const uint16_t pc = m->watch_pc ? *m->watch_pc : 0;
+
+    for (int i = 0; i < MEM_WATCH_MAX; ++i) {
+        const mem_watch_t *w = &m->watches[i];
+        if ((w->kinds & kind) && adr >= w->first && adr <= w->last) {
+            w->fn(w->ctx, pc, adr, value, kind);
+        }
+    }
+}
+
+static void mem_watch_update(mem_t *m)
+{
+    uint8_t exec_before[256];
+
+    for (int page = 0; page < 256; ++page) {
+        exec_before[page] = m->watch_pages[page] & MEM_WATCH_EXEC;
+        m->watch_pages[page] = 0;
+    }
+    for (int i = 0; i < MEM_WATCH_MAX; ++i) {
+        const mem_watch_t *w = &m->watches[i];
+        for (int page = w->first >> 8; w->kinds && page <= (w->last >> 8); ++page) {
+            m->watch_pages[page] |= w->kinds;
+        }
+    }
+    for (int page = 0; page < 256; ++page) {
+        if (exec_before[page] != (m->watch_pages[page] & MEM_WATCH_EXEC)) {
+            m->watch_gen++;         // decoded code for the page is stale
+        }
+        mem_update_rmap(m, (uint8_t)page);
+        mem_update_wmap(m, (uint8_t)page);
+    }
+}
+
+int mem_watch_add(mem_t *m, uint16_t first, uint16_t last, uint8_t kinds,
+                  mem_watch_fn fn, void *ctx)
+{
+    kinds &= MEM_WATCH_READ | MEM_WATCH_WRITE | MEM_WATCH_EXEC;
+    if (!kinds || !fn || last < first) {
+        return -1;
+    }
+    for (int i = 0; i < MEM_WATCH_MAX; ++i) {
+        mem_watch_t *w = &m->watches[i];
+        if (!w->kinds) {
+            w->first = first;
+            w->last = last;
+            w->kinds = kinds;
+            w->fn = fn;
+            w->ctx = ctx;
+            mem_watch_update(m);
+            return i;
+        }
+    }
+    return -1;
+}
+
+void mem_watch_remove(mem_t *m, int id)
+{
+    if (id >= 0 && id < MEM_WATCH_MAX && m->watches[id].kinds) {
+        m->watches[id].kinds = 0;
+        mem_watch_update(m);
+    }
+}
+
+void mem_watch_set_pc(mem_t *m, const uint16_t *pc)
+{
+    m->watch_pc = pc;
+}
+
+uint32_t mem_code_map(const mem_t *m)
+{
+    return ((uint32_t)m->watch_gen << 16) | m->mapped_bank[0];
+}
+
+int mem_fetch_cacheable(const mem_t *m, uint16_t adr)
+{
+    return !m->dma_lock && !(m->watch_pages[adr >> 8] & MEM_WATCH_EXEC);
+}
+
+/* OAM, I/O, HRAM, IE and everything not backed by memory */
+static uint8_t mem_read_area(mem_t *m, uint16_t adr)
+{
+    if (adr >= 0xA000 && adr < 0xC000) { // disabled ERAM or MBC3 RTC register
+        if (m->rtc_present && m->ram_enable && m->ram_bank >= 0x08) {
+            return m->rtc_latched[m->ram_bank - 0x08];
+        }
+        return 0xFF;
+    } else if (adr < 0xFE00) {      // past the end of the ROM image
+        return 0xFF;
+    } else if (adr < 0xFEA0) {      // FE00–FE9F: Sprite attribute table (OAM)
+        return m->oam[adr - 0xFE00];
+    } else if (adr < 0xFF00) {      // FEA0–FEFF: Unusable memory
+        return 0xFF;
+    } else if (adr < 0xFF80) {      // FF00–FF7F: I/O Registers
+        const mem_io_handler_t *h = &m->io_handlers[adr - 0xFF00];
+        return h->read(h->ctx, m, (uint8_t)(adr - 0xFF00));
+    } else if (adr < 0xFFFF) {      // FF80–FFFE: High RAM (HRAM)
+        return m->hram[adr - 0xFF80];
+    } else {                        // FFFF: Interrupt Enable Register
+        return m->ie;
+    }
+}
+
+/* Everything rmap leaves out, kind is the MEM_WATCH_* the access can hit */
+static uint8_t mem_read_slow(mem_t *m, uint16_t adr, uint8_t kind)
+{
+    if (m->dma_lock && adr < 0xFF00) { // OAM DMA owns the bus
+        return 0xFF;
+    }
+
+    const uint8_t *page = m->rpage[adr >> 8];
+    const uint8_t value = page ? page[adr & 0xFF] : mem_read_area(m, adr);
+
+    if (m->watch_pages[adr >> 8] & kind) {
+        mem_watch_hit(m, adr, value, kind);
+    }
+    return value;
+}
+
+uint8_t mem_read_byte(mem_t *m, uint16_t adr)
+{
+    const uint8_t *page = m->rmap[adr >> 8];
+
+    if (page) {
+        return page[adr & 0xFF];
+    }
+    return mem_read_slow(m, adr, MEM_WATCH_READ);
+}
+
+uint8_t mem_fetch_byte(mem_t *m, uint16_t adr)
+{
+    const uint8_t *page = m->rmap[adr >> 8];
+
+    if (page) {
+        return page[adr & 0xFF];
+    }
+    return mem_read_slow(m, adr, MEM_WATCH_EXEC);
+}
+
+/* What the bus returns at adr, for decoders looking ahead (JIT, icache,
+ * idle-loop detector): same value as mem_read_byte, no watchpoint */
+uint8_t mem_peek_byte(mem_t *m, uint16_t adr)
+{
+    const uint8_t *page = m->rmap[adr >> 8];
+
+    if (page) {
+        return page[adr & 0xFF];
+    }
+    return mem_read_slow(m, adr, 0);
+}
+
+uint16_t mem_peek_word(mem_t *m, uint16_t adr)
+{
+    return mem_peek_byte(m, adr) | (mem_peek_byte(m, adr + 1) << 8);
+}
+
+uint16_t mem_read_word(mem_t *m, uint16_t adr)
+{
+    uint8_t low = mem_read_byte(m, adr);
+    uint8_t high = mem_read_byte(m, adr + 1);
+
+    return (high << 8) | low;
+}
+
+static void mem_write_slow(mem_t *m, uint16_t adr, uint8_t value)
+{
+    if (m->dma_lock && adr < 0xFF00) {
+        return;
+    }
+    if (m->watch_pages[adr >> 8] & MEM_WATCH_WRITE) {
+        mem_watch_hit(m, adr, value, MEM_WATCH_WRITE);
+    }
+    if (m->code_pages[adr >> 8]) {
+        m->events |= MEM_EV_CODE;
+        m->code_hook(m->code_ctx, adr);
+    }
+    if ((adr & 0xE000) == 0x8000) { // 8000–9FFF: VRAM
+        mem_vram_write(m, adr - 0x8000, value);
+        return;
+    }
+    if (m->wpage[adr >> 8]) {       // plain memory on a code page or clean ERAM
+        if (adr >= 0xA000 && adr < 0xC000 && !m->eram_dirty) {
+            m->eram_dirty = 1;
+            mem_map_eram(m);        // first write since mem_eram_dirty(): unprotect
+        }
+        m->wpage[adr >> 8][adr & 0xFF] = value;
+        return;
+    }
+
+    if (adr < 0x8000) {             // 0000–7FFF: mapper registers
+        mem_mbc_write(m, adr, value);
+    } else if (adr >= 0xA000 && adr < 0xC000) {
+        if (m->rtc_present && m->ram_enable && m->ram_bank >= 0x08) {
+            static const uint8_t rtc_mask[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+            m->rtc[m->ram_bank - 0x08] = value & rtc_mask[m->ram_bank - 0x08];
+        }
+    } else if (adr < 0xFE00) {
+        /* open bus */
+    } else if (adr < 0xFEA0) {      // FE00–FE9F: OAM
+        mem_oam_write(m, (uint8_t)(adr - 0xFE00), value);
+    } else if (adr < 0xFF00) {
+        /* unusable memory */
+    } else if (adr < 0xFF80) {      // FF00–FF7F: I/O Registers
+        const mem_io_handler_t *h = &m->io_handlers[adr - 0xFF00];
+        h->write(h->ctx, m, (uint8_t)(adr - 0xFF00), value);
+    } else if (adr < 0xFFFF) {      // FF80–FFFE: HRAM
+        m->hram[adr - 0xFF80] = value;
+    } else {
+        m->ie = value;
+        m->events |= MEM_EV_IRQ;
+    }
+}
+
+void mem_write_byte(mem_t *m, uint16_t adr, uint8_t value)
+{
+    uint8_t *page = m->wmap[adr >> 8];
+
+    if (page) {
+        page[adr & 0xFF] = value;
+        return;
+    }
+    mem_write_slow(m, adr, value);
 }
 
 void mem_write_word(mem_t *m, uint16_t adr, uint16_t value)
@@ -121,20 +753,137 @@ void mem_write_word(mem_t *m, uint16_t adr, uint16_t value)
     mem_write_byte(m, adr + 1, value >> 8);
 }
 
-/* TODOS: mem_wb(), mem_rw(), mem_ww() would mirror the same map,
-   plus call-outs for DMA, joypad latches, timer increments, etc.        */
+uint8_t *mem_events(mem_t *m)
+{
+    return &m->events;
+}
 
-mem_t *mem_create(const uint8_t *rom_image, size_t rom_size){
+void mem_set_code_hook(mem_t *m, mem_code_write_fn fn, void *ctx)
+{
+    m->code_hook = fn;
+    m->code_ctx = ctx;
+    if (!fn) {
+        memset(m->code_pages, 0, sizeof(m->code_pages));
+        for (int page = 0; page < 256; ++page) {
+            mem_update_wmap(m, (uint8_t)page);
+        }
+    }
+}
+
+void mem_mark_code_page(mem_t *m, uint8_t page, int on)
+{
+    m->code_pages[page] = (on && m->code_hook) ? 1 : 0;
+    mem_update_wmap(m, page);
+}
+
+uint16_t mem_rom_bank(const mem_t *m)
+{
+    return m->mapped_bank[1];
+}
+
+uint16_t mem_rom_bank0(const mem_t *m)
+{
+    return m->mapped_bank[0];
+}
+
+uint16_t mem_ram_bank(const mem_t *m)
+{
+    if (!m->eram || !m->ram_enable || (m->mbc_type == MEM_MBC3 && m->ram_bank >= 0x08)) {
+        return MEM_RAM_UNMAPPED;
+    }
+    return m->ram_bank;
+}
+
+uint8_t mem_mbc_type(const mem_t *m)
+{
+    return m->mbc_type;
+}
+
+const uint8_t *mem_vram(const mem_t *m)
+{
+    return m->vram;
+}
+
+const uint8_t *mem_oam(const mem_t *m)
+{
+    return m->oam;
+}
+
+const mem_dirty_t *mem_dirty(const mem_t *m)
+{
+    return &m->dirty;
+}
+
+void mem_dirty_clear(mem_t *m, const mem_dirty_t *bits)
+{
+    if (!bits) {
+        memset(&m->dirty, 0, sizeof(m->dirty));
+        return;
+    }
+    for (int i = 0; i < 6; ++i) {
+        m->dirty.tiles[i] &= ~bits->tiles[i];
+    }
+    m->dirty.map_rows &= ~bits->map_rows;
+    m->dirty.oam &= ~bits->oam;
+}
+
+int mem_eram_dirty(mem_t *m)
+{
+    int dirty = m->eram_dirty;
+
+    if (dirty) {
+        m->eram_dirty = 0;
+        mem_map_eram(m);            // catch the next write again
+    }
+    return dirty;
+}
+
+mem_t *mem_create_cart(const uint8_t *rom_image, size_t rom_size, const mem_cart_t *cart)
+{
     mem_t *memory = (mem_t *) calloc(1, sizeof(mem_t));
     if (!memory) {
         return NULL;
     }
     memory->rom = rom_image;
     memory->rom_size = rom_size;
+    memory->rom_banks = (rom_size > 0x8000) ? (uint16_t)(rom_size / 0x4000) : 2;
+    memory->mapped_bank[1] = 1;
+
+    memory->mbc_type = cart->mbc_type;
+    memory->rtc_present = cart->rtc;
+    memory->eram_size = cart->ram_size;
+    memory->ram_enable = (cart->mbc_type == MEM_MBC_NONE);  /* no mapper: always on */
+    if (cart->ram) {
+        memory->eram = cart->ram;
+        memory->eram_track = 1;
+    } else if (memory->eram_size) {
+        memory->eram = (uint8_t *)calloc(1, memory->eram_size);
+        memory->eram_owned = 1;
+        if (!memory->eram) {
+            free(memory);
+            return NULL;
+        }
+    }
+    mem_map_update(memory);
+    mem_io_init(memory);
+    memset(memory->dirty.tiles, 0xFF, sizeof(memory->dirty.tiles));
+    memory->dirty.map_rows = ~0ull;
+    memory->dirty.oam = (1ull << 40) - 1;
+    memory->serial_fn = serial_write_stdout;
 
     return memory;
 }
 
+mem_t *mem_create(const uint8_t *rom_image, size_t rom_size){
+    const mem_cart_t plain = {MEM_MBC_NONE, 0, 0, 8 * 1024, NULL};
+
+    return mem_create_cart(rom_image, rom_size, &plain);
+}
+
 void mem_reset (mem_t *m){
+    mem_serial_flush(m);
+    if (m->eram_owned) {
+        free(m->eram);
+    }
     free(m);
 }
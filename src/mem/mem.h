@@ -13,15 +13,132 @@ extern "C" {
 
 typedef struct mem mem_t;      /* forward-declare opaque struct */
 
+/* Event bits raised by the bus, polled by the cpu run loop */
+#define MEM_EV_IRQ  (1u << 0)  /* IF (0xFF0F) or IE (0xFFFF) was written */
+#define MEM_EV_CODE (1u << 1)  /* a page marked as code was written */
+#define MEM_EV_BANK (1u << 2)  /* the mapper switched the ROM or cartridge RAM mapping */
+#define MEM_EV_DMA  (1u << 3)  /* a timed OAM DMA locked the bus */
+
+/* OAM DMA modes, see mem_set_dma_mode() */
+#define MEM_DMA_TIMED   (0)  /* 160 M-cycles, bus locked except FF00-FFFF */
+#define MEM_DMA_INSTANT (1)  /* whole copy at the FF46 write, no locking */
+
+#define MEM_RAM_UNMAPPED (0xFFFF) /* mem_ram_bank(): A000-BFFF reads FF (or the RTC) */
+
+/* Cartridge mappers (mem_cart_t) */
+#define MEM_MBC_NONE (0)
+#define MEM_MBC1     (1)
+#define MEM_MBC3     (3)
+#define MEM_MBC5     (5)
+
+/* Called before a write lands on a page marked with mem_mark_code_page() */
+typedef void (*mem_code_write_fn)(void *ctx, uint16_t addr);
+
+/* Watchpoint kinds, see mem_watch_add() */
+#define MEM_WATCH_READ  (1u << 0)
+#define MEM_WATCH_WRITE (1u << 1)
+#define MEM_WATCH_EXEC  (1u << 2)  /* opcode fetch, see mem_fetch_byte() */
+
+/* Called on a watched access: value is the byte read, about to be written,
+ * or the opcode fetched. pc comes from mem_watch_set_pc(). */
+typedef void (*mem_watch_fn)(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind);
+
+/* I/O register handlers (FF00-FF7F), reg is the offset from FF00 */
+typedef uint8_t (*mem_io_read_fn)(void *ctx, mem_t *m, uint8_t reg);
+typedef void (*mem_io_write_fn)(void *ctx, mem_t *m, uint8_t reg, uint8_t value);
+
 /* Public bus helpers */
 uint8_t mem_read_byte (mem_t *m, uint16_t addr);               /* read  byte  */
 void mem_write_byte (mem_t *m, uint16_t addr, uint8_t value);   /* write byte */
 
 uint16_t mem_read_word (mem_t *m, uint16_t addr);              /* read  word  */
+uint8_t mem_fetch_byte(mem_t *m, uint16_t addr);                /* opcode fetch */
+uint8_t mem_peek_byte(mem_t *m, uint16_t addr);   /* decoder read, never hits a watchpoint */
+uint16_t mem_peek_word(mem_t *m, uint16_t addr);
 void mem_write_word (mem_t *m, uint16_t addr, uint16_t value);  /* write word */
 
-/* Constructor / reset */
+/* Pending bus events (MEM_EV_*), the cpu clears them once handled */
+uint8_t *mem_events(mem_t *m);
+
+/* I/O dispatch. Registers without a handler are plain storage, a NULL
+ * read or write function restores that default. Handlers keep their state
+ * in mem_io_regs() where it fits, writes there have no side effects. */
+void mem_io_register(mem_t *m, uint8_t reg, mem_io_read_fn rd, mem_io_write_fn wr, void *ctx);
+uint8_t *mem_io_regs(mem_t *m);
+
+/* Serial port output (SB/SC). Bytes sent by the game queue up in a ring
+ * buffer and reach the sink in batches: when the buffer is full, on
+ * mem_serial_flush() and in mem_reset(). The default sink is stdout. With
+ * a NULL sink the bytes stay queued for mem_serial_read() instead (capture
+ * mode), the oldest are dropped once the buffer is full. Changing the sink
+ * flushes to the old one first. */
+typedef void (*mem_serial_fn)(void *ctx, const uint8_t *data, size_t len);
+void mem_serial_sink(mem_t *m, mem_serial_fn fn, void *ctx);
+void mem_serial_flush(mem_t *m);
+size_t mem_serial_read(mem_t *m, uint8_t *out, size_t size);
+
+/* Direct views for the PPU: 8K VRAM at 8000, 160 bytes OAM at FE00. No
+ * bus semantics (DMA locking, watchpoints) apply. */
+const uint8_t *mem_vram(const mem_t *m);
+const uint8_t *mem_oam(const mem_t *m);
+
+/* OAM DMA (FF46). Timed transfers advance with mem_step(), which the host
+ * calls with the M-cycles of every cpu step (cpu_t.cycles). While one runs
+ * the cpu only reaches I/O, HRAM and IE, everything else reads FF. */
+void mem_set_dma_mode(mem_t *m, int mode);
+int mem_dma_active(const mem_t *m);
+void mem_step(mem_t *m, uint32_t cycles);
+
+/* What the game changed in VRAM and OAM since it was last cleared, so
+ * renderers and caches only redo that part. Writes storing the value
+ * already there do not count. Everything starts out dirty. Consumers
+ * clear the bits they handled, NULL clears everything. */
+typedef struct {
+    uint64_t tiles[6];  /* bit n: tile n, 16 bytes at 8000 + 16n (384 tiles) */
+    uint64_t map_rows;  /* bit n: 32 byte tile-map row at 9800 + 32n, 9C00 map from bit 32 */
+    uint64_t oam;       /* bit n: sprite n, 4 bytes at FE00 + 4n (40 sprites) */
+} mem_dirty_t;
+
+const mem_dirty_t *mem_dirty(const mem_t *m);
+void mem_dirty_clear(mem_t *m, const mem_dirty_t *bits);
+
+/* Watchpoints on [first, last]. Watched pages leave the page table and
+ * go through the slow path, all other pages keep the fast path, so they
+ * cost nothing while none are set. Returns an id for mem_watch_remove(),
+ * -1 if all slots are taken. The icache and JIT pick up exec watches at
+ * the next cpu_step()/cpu_run()/cpu_jit_run() call. */
+int mem_watch_add(mem_t *m, uint16_t first, uint16_t last, uint8_t kinds,
+                  mem_watch_fn fn, void *ctx);
+void mem_watch_remove(mem_t *m, int id);
+void mem_watch_set_pc(mem_t *m, const uint16_t *pc); /* e.g. &cpu.pc */
+
+/* Translated-code tracking (used by the JIT) */
+void mem_set_code_hook(mem_t *m, mem_code_write_fn fn, void *ctx);
+void mem_mark_code_page(mem_t *m, uint8_t page, int on);
+uint16_t mem_rom_bank(const mem_t *m);   /* bank mapped at 4000-7FFF */
+uint16_t mem_rom_bank0(const mem_t *m);  /* bank mapped at 0000-3FFF, moves only on MBC1 */
+uint16_t mem_ram_bank(const mem_t *m);   /* 8K bank mapped at A000-BFFF or MEM_RAM_UNMAPPED */
+uint32_t mem_code_map(const mem_t *m);   /* changes with mem_rom_bank0() or the exec watches */
+int mem_fetch_cacheable(const mem_t *m, uint16_t addr); /* decoded code at addr may be kept */
+
+/* Mapper */
+uint8_t mem_mbc_type(const mem_t *m);
+void mem_rtc_advance(mem_t *m, uint32_t seconds); /* MBC3 clock, fed by the frontend */
+int mem_eram_dirty(mem_t *m); /* caller-owned RAM written since the last call */
+
+/* Cartridge description for mem_create_cart(), see rom_parse_header() */
+typedef struct {
+    uint8_t mbc_type;   /* MEM_MBC_* */
+    uint8_t rtc;        /* MBC3 clock present */
+    uint8_t battery;    /* external RAM is battery backed */
+    size_t  ram_size;   /* external RAM in bytes, 0 if none */
+    uint8_t *ram;       /* caller-owned RAM (e.g. a mapped .sav), NULL: allocated */
+} mem_cart_t;
+
+/* Constructor / reset. mem_create() ignores the header: no mapper and 8K
+ * of plain RAM at A000-BFFF, e.g. for test images. */
 mem_t *mem_create(const uint8_t *rom_image, size_t rom_size);
+mem_t *mem_create_cart(const uint8_t *rom_image, size_t rom_size, const mem_cart_t *cart);
 void mem_reset (mem_t *m);
 
 #ifdef __cplusplus
@@ -1,64 +1,409 @@
 #include "ppu.h"
 #include <string.h>
 
-static const uint32_t palette[4] = {
+#define DOTS_PER_LINE   (456)
+#define DOTS_OAM        (80)
+#define DOTS_DRAW       (172)
+#define LINES_VISIBLE   (144)
+#define LINES_PER_FRAME (154)
+#define DOTS_PER_FRAME  (DOTS_PER_LINE * LINES_PER_FRAME)
+
+/* I/O registers, offsets from FF00 */
+#define REG_IF   (0x0F)
+#define REG_LCDC (0x40)
+#define REG_STAT (0x41)
+#define REG_SCY  (0x42)
+#define REG_SCX  (0x43)
+#define REG_LY   (0x44)
+#define REG_LYC  (0x45)
+#define REG_BGP  (0x47)
+#define REG_OBP0 (0x48)
+#define REG_OBP1 (0x49)
+#define REG_WY   (0x4A)
+#define REG_WX   (0x4B)
+
+#define LCDC_BG_ON     (1u << 0)  /* DMG: background and window */
+#define LCDC_OBJ_ON    (1u << 1)
+#define LCDC_OBJ_8X16  (1u << 2)
+#define LCDC_BG_MAP    (1u << 3)  /* 9C00 instead of 9800 */
+#define LCDC_TILES_8000 (1u << 4) /* unsigned tile numbers from 8000, else signed from 9000 */
+#define LCDC_WIN_ON    (1u << 5)
+#define LCDC_WIN_MAP   (1u << 6)
+#define LCDC_LCD_ON    (1u << 7)
+
+/* OAM attribute byte */
+#define OBJ_PAL1      (1u << 4)
+#define OBJ_XFLIP     (1u << 5)
+#define OBJ_YFLIP     (1u << 6)
+#define OBJ_BEHIND_BG (1u << 7)   /* only over BG color 0 */
+
+#define STAT_LYC_EQ   (1u << 2)
+#define STAT_IRQ_HBL  (1u << 3)
+#define STAT_IRQ_VBL  (1u << 4)
+#define STAT_IRQ_OAM  (1u << 5)
+#define STAT_IRQ_LYC  (1u << 6)
+
+/* DMG shades, palette registers pick one per color index */
+static const uint32_t shades[4] = {
     0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF
 };
 
-void ppu_init(ppu_t *p, uint32_t *frame)
+/* Set an IF bit directly, the PPU is not a cpu store (no write watchpoint) */
+static void ppu_request_irq(mem_t *m, uint8_t bit)
 {
-    memset(p, 0, sizeof(*p));
-    p->frame = frame;
+    mem_io_regs(m)[REG_IF] |= bit;
+    *mem_events(m) |= MEM_EV_IRQ;
 }
 
-void ppu_reset(ppu_t *p)
+/*
+* STAT. Mode and LYC=LY bits are kept up to date in the register, the
+* interrupt sources are OR'ed into one line and only its rising edge
+* requests an interrupt, as on hardware.
+*/
+static void ppu_update_stat(ppu_t *p, mem_t *m)
 {
-    uint32_t *fb = p->frame;
-    memset(p, 0, sizeof(*p));
-    p->frame = fb;
-}
-
-static void draw_tile_row(ppu_t *p, mem_t *m,
-                          uint16_t tile_base, int tile_index,
-                          int row, int x, int y)
-{
-    uint16_t adr = tile_base + tile_index * 16 + row * 2;
-    uint8_t lo = mem_read_byte(m, adr);
-    uint8_t hi = mem_read_byte(m, adr + 1);
-    for (int i = 0; i < 8; ++i) {
-        int bit = 7 - i;
-        int color_id = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
-        uint32_t color = palette[color_id];
-        int px = x + i;
-        int py = y;
-        if (px >= 0 && px < 160 && py >= 0 && py < 144) {
-            p->frame[py * 160 + px] = color;
+    uint8_t *io = mem_io_regs(m);
+    uint8_t stat = (io[REG_STAT] & 0x78) | p->mode;
+
+    if (p->ly == io[REG_LYC]) {
+        stat |= STAT_LYC_EQ;
+    }
+    io[REG_STAT] = stat;
+    io[REG_LY] = p->ly;
+
+    const uint8_t line = ((stat & STAT_IRQ_LYC) && (stat & STAT_LYC_EQ)) ||
+                         ((stat & STAT_IRQ_HBL) && p->mode == PPU_MODE_HBLANK) ||
+                         ((stat & STAT_IRQ_VBL) && p->mode == PPU_MODE_VBLANK) ||
+                         ((stat & STAT_IRQ_OAM) && p->mode == PPU_MODE_OAM);
+    if (line && !p->stat_line) {
+        ppu_request_irq(m, 0x02);
+    }
+    p->stat_line = line;
+}
+
+static uint8_t ppu_read_stat(void *ctx, mem_t *m, uint8_t reg)
+{
+    (void)ctx;
+    return mem_io_regs(m)[reg] | 0x80;  /* bit 7 reads as 1 */
+}
+
+static void ppu_write_stat(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    uint8_t *io = mem_io_regs(m);
+
+    io[reg] = (value & 0x78) | (io[reg] & 0x07);   /* mode and LYC=LY are read-only */
+    ppu_update_stat((ppu_t *)ctx, m);
+}
+
+static void ppu_write_lyc(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    mem_io_regs(m)[reg] = value;
+    ppu_update_stat((ppu_t *)ctx, m);
+}
+
+/* LCDC bit 7: switching the LCD off parks the PPU at line 0 in mode 0
+ * with a blank screen, switching it on restarts line 0 at mode 2 */
+static void ppu_write_lcdc(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    ppu_t *p = (ppu_t *)ctx;
+    uint8_t *io = mem_io_regs(m);
+    const uint8_t changed = io[reg] ^ value;
+
+    io[reg] = value;
+    if (!(changed & LCDC_LCD_ON)) {
+        return;
+    }
+    p->lcd_on = (value & LCDC_LCD_ON) != 0;
+    p->dot = 0;
+    p->ly = 0;
+    p->win_line = 0;
+    if (p->lcd_on) {
+        p->mode = PPU_MODE_OAM;
+        p->next = DOTS_OAM;
+    } else {
+        p->mode = PPU_MODE_HBLANK;
+        p->next = DOTS_PER_FRAME;       /* blank frames keep the host paced */
+        for (int i = 0; i < 160 * 144; ++i) {
+            p->frame[i] = shades[0];
+        }
+    }
+    ppu_update_stat(p, m);
+}
+
+static void ppu_write_ly(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    (void)ctx;
+    (void)m;
+    (void)reg;
+    (void)value;                        /* read-only */
+}
+
+/*
+* Tile cache. Decoding the 2bpp rows once per VRAM change turns drawing
+* into index copies plus a palette lookup.
+*/
+static void decode_tile(ppu_t *p, const uint8_t *vram, int tile)
+{
+    p->kernels->decode_tile(vram + tile * 16, p->tile_px[0][tile], p->tile_px[1][tile]);
+}
+
+static void update_tiles(ppu_t *p, mem_t *m)
+{
+    const mem_dirty_t *dirty = mem_dirty(m);
+    mem_dirty_t handled = {};
+    int any = 0;
+
+    for (int i = 0; i < 6; ++i) {
+        handled.tiles[i] = dirty->tiles[i];
+        any |= dirty->tiles[i] != 0;
+    }
+    if (!any) {
+        return;
+    }
+
+    const uint8_t *vram = mem_vram(m);
+    for (int i = 0; i < 6; ++i) {
+        for (uint64_t bits = handled.tiles[i]; bits; bits &= bits - 1) {
+            decode_tile(p, vram, i * 64 + __builtin_ctzll(bits));
         }
     }
+    mem_dirty_clear(m, &handled);
 }
 
-static void render_frame(ppu_t *p, mem_t *m)
+/*
+* Copy count tiles of one map row, starting at column col (wrapping at
+* 32), as color indices of the given pixel row. The map row is read once
+* per scanline straight from VRAM.
+*/
+static void fetch_map_row(const ppu_t *p, const uint8_t *map_row, int col, int count,
+                          int row, uint8_t lcdc, uint8_t *dst)
 {
-    uint16_t bg_map = 0x9800;
-    uint16_t tile_base = 0x8000;
-    for (int ty = 0; ty < 18; ++ty) {
-        for (int tx = 0; tx < 20; ++tx) {
-            int map_index = ty * 32 + tx;
-            int tile_index = mem_read_byte(m, bg_map + map_index);
-            for (int row = 0; row < 8; ++row) {
-                draw_tile_row(p, m, tile_base, tile_index, row,
-                              tx * 8, ty * 8 + row);
+    for (int c = 0; c < count; ++c) {
+        const uint8_t t = map_row[(col + c) & 31];
+        const int tile = (lcdc & LCDC_TILES_8000) ? t : (t < 128) ? 256 + t : t;
+        memcpy(dst + c * 8, p->tile_px[0][tile] + row * 8, 8);
+    }
+}
+
+/*
+* Mode 2: pick the first 10 sprites in OAM that cover line ly and keep
+* them in drawing priority order (lower X first, then lower OAM index),
+* so mode 3 only looks at these instead of all 40 entries.
+*/
+static void scan_oam(ppu_t *p, mem_t *m)
+{
+    const uint8_t *oam = mem_oam(m);
+    const int height = (mem_io_regs(m)[REG_LCDC] & LCDC_OBJ_8X16) ? 16 : 8;
+    int n = 0;
+
+    for (int i = 0; i < 40 && n < PPU_LINE_OBJS; ++i) {
+        const int y = p->ly + 16 - oam[i * 4];
+        if (y < 0 || y >= height) {
+            continue;
+        }
+        /* Insert after every entry with X <= this one, OAM order breaks ties */
+        int at = n++;
+        while (at > 0 && oam[p->objs[at - 1] * 4 + 1] > oam[i * 4 + 1]) {
+            p->objs[at] = p->objs[at - 1];
+            at--;
+        }
+        p->objs[at] = (uint8_t)i;
+    }
+    p->n_objs = (uint8_t)n;
+}
+
+/*
+* Sprites of line ly over the expanded background. The first opaque
+* sprite pixel in priority order owns its column, even if it then hides
+* behind a non-zero BG color.
+*/
+static void render_objs(const ppu_t *p, mem_t *m, const uint8_t *bg, uint32_t *out)
+{
+    const uint8_t *io = mem_io_regs(m);
+    const uint8_t *oam = mem_oam(m);
+    const int tall = (io[REG_LCDC] & LCDC_OBJ_8X16) != 0;
+    uint8_t taken[160] = {0};
+    uint32_t pal[2][4];
+
+    for (int n = 0; n < 2; ++n) {
+        const uint8_t obp = io[REG_OBP0 + n];
+        for (int c = 0; c < 4; ++c) {
+            pal[n][c] = shades[(obp >> (2 * c)) & 3];
+        }
+    }
+
+    for (int i = 0; i < p->n_objs; ++i) {
+        const uint8_t *obj = oam + p->objs[i] * 4;
+        const uint8_t attr = obj[3];
+        const int x0 = obj[1] - 8;
+        int row = p->ly + 16 - obj[0];
+        int tile = obj[2];
+
+        if (tall) {
+            row = (attr & OBJ_YFLIP) ? 15 - row : row;
+            tile = (tile & 0xFE) | (row >> 3);
+            row &= 7;
+        } else if (attr & OBJ_YFLIP) {
+            row = 7 - row;
+        }
+
+        const uint8_t *px = p->tile_px[(attr & OBJ_XFLIP) ? 1 : 0][tile] + row * 8;
+        const uint32_t *colors = pal[(attr & OBJ_PAL1) ? 1 : 0];
+        for (int b = 0; b < 8; ++b) {
+            const int x = x0 + b;
+            if (x < 0 || x >= 160 || !px[b] || taken[x]) {
+                continue;
             }
+            taken[x] = 1;
+            if (!(attr & OBJ_BEHIND_BG) || !bg[x]) {
+                out[x] = colors[px[b]];
+            }
+        }
+    }
+}
+
+/* Line ly, as LCDC, SCX/SCY, WX/WY and the palettes are now */
+static void render_line(ppu_t *p, mem_t *m)
+{
+    const uint8_t *io = mem_io_regs(m);
+    const uint8_t *vram = mem_vram(m);
+    const uint8_t lcdc = io[REG_LCDC];
+    uint32_t *out = p->frame + p->ly * 160;
+    uint8_t line[160];
+    uint8_t fetched[21 * 8];
+
+    update_tiles(p, m);
+    if (!(lcdc & LCDC_BG_ON)) {
+        /* Blank background, sprites still show over it */
+        memset(line, 0, sizeof(line));
+        for (int i = 0; i < 160; ++i) {
+            out[i] = shades[0];
+        }
+        if ((lcdc & LCDC_OBJ_ON) && p->n_objs) {
+            render_objs(p, m, line, out);
         }
+        return;
+    }
+
+    /* Background: 21 tiles cover any fine scroll */
+    const uint8_t y = p->ly + io[REG_SCY];
+    const uint8_t scx = io[REG_SCX];
+    const uint8_t *bg_map = vram + ((lcdc & LCDC_BG_MAP) ? 0x1C00 : 0x1800);
+    fetch_map_row(p, bg_map + (y / 8) * 32, scx / 8, 21, y % 8, lcdc, fetched);
+    memcpy(line, fetched + (scx % 8), 160);
+
+    /* Window from WX - 7, its own line counter only runs while it is shown */
+    const int wx = io[REG_WX] - 7;
+    if ((lcdc & LCDC_WIN_ON) && p->ly >= io[REG_WY] && wx < 160) {
+        const uint8_t *win_map = vram + ((lcdc & LCDC_WIN_MAP) ? 0x1C00 : 0x1800);
+        const int start = (wx < 0) ? 0 : wx;
+        fetch_map_row(p, win_map + (p->win_line / 8) * 32, 0, 21, p->win_line % 8, lcdc, fetched);
+        memcpy(line + start, fetched + (start - wx), 160 - start);
+        p->win_line++;
+    }
+
+    const uint8_t bgp = io[REG_BGP];
+    const uint32_t pal[4] = {
+        shades[bgp & 3], shades[(bgp >> 2) & 3], shades[(bgp >> 4) & 3], shades[bgp >> 6]
+    };
+    p->kernels->expand(line, pal, out, 160);
+    if ((lcdc & LCDC_OBJ_ON) && p->n_objs) {
+        render_objs(p, m, line, out);
+    }
+}
+
+/* Leave the current mode at p->next */
+static void ppu_advance_mode(ppu_t *p, mem_t *m)
+{
+    if (!p->lcd_on) {
+        p->dot = 0;
+        p->frames++;
+        return;
+    }
+    switch (p->mode) {
+        case PPU_MODE_OAM:
+            scan_oam(p, m);
+            p->mode = PPU_MODE_DRAW;
+            p->next = DOTS_OAM + DOTS_DRAW;
+            break;
+        case PPU_MODE_DRAW:
+            render_line(p, m);
+            p->mode = PPU_MODE_HBLANK;
+            p->next = DOTS_PER_LINE;
+            break;
+        default:                        /* end of an HBlank or VBlank line */
+            p->dot = 0;
+            p->ly++;
+            if (p->ly == LINES_VISIBLE) {
+                p->mode = PPU_MODE_VBLANK;
+                p->next = DOTS_PER_LINE;
+                p->frames++;
+                ppu_request_irq(m, 0x01);
+            } else if (p->ly < LINES_VISIBLE || p->ly == LINES_PER_FRAME) {
+                if (p->ly == LINES_PER_FRAME) {
+                    p->ly = 0;
+                    p->win_line = 0;
+                }
+                p->mode = PPU_MODE_OAM;
+                p->next = DOTS_OAM;
+            }
+            break;
+    }
+    ppu_update_stat(p, m);
+}
+
+void ppu_init(ppu_t *p, uint32_t *frame, mem_t *m)
+{
+    memset(p, 0, sizeof(*p));
+    p->frame = frame;
+    p->mode = PPU_MODE_OAM;
+    p->next = DOTS_OAM;
+    p->kernels = ppu_kernels_best();
+    p->lcd_on = 1;
+
+    /* Registers as the boot ROM leaves them */
+    uint8_t *io = mem_io_regs(m);
+    io[REG_LCDC] = 0x91;
+    io[REG_BGP] = 0xFC;
+
+    mem_io_register(m, REG_LCDC, NULL, ppu_write_lcdc, p);
+    mem_io_register(m, REG_STAT, ppu_read_stat, ppu_write_stat, p);
+    mem_io_register(m, REG_LY, NULL, ppu_write_ly, p);
+    mem_io_register(m, REG_LYC, NULL, ppu_write_lyc, p);
+    ppu_update_stat(p, m);
+
+    /* The dirty bits may have been consumed before, start from VRAM */
+    for (int tile = 0; tile < PPU_TILES; ++tile) {
+        decode_tile(p, mem_vram(m), tile);
     }
 }
 
+/* Back to line 0, the tile cache still matches VRAM */
+void ppu_reset(ppu_t *p)
+{
+    p->dot = 0;
+    p->next = p->lcd_on ? DOTS_OAM : DOTS_PER_FRAME;
+    p->ly = 0;
+    p->win_line = 0;
+    p->n_objs = 0;
+    p->mode = p->lcd_on ? PPU_MODE_OAM : PPU_MODE_HBLANK;
+    p->stat_line = 0;
+    p->frames = 0;
+}
+
 void ppu_step(ppu_t *p, uint64_t delta, mem_t *m)
 {
-    p->cycle += delta;
-    const uint64_t CYCLES_PER_FRAME = 70224;
-    if (p->cycle >= CYCLES_PER_FRAME) {
-        p->cycle -= CYCLES_PER_FRAME;
-        render_frame(p, m);
+    uint64_t dots = delta * 4;
+
+    while (p->dot + dots >= p->next) {
+        dots -= p->next - p->dot;
+        p->dot = p->next;
+        ppu_advance_mode(p, m);
     }
+    p->dot += (uint32_t)dots;
+}
+
+uint32_t ppu_cycles_to_event(const ppu_t *p)
+{
+    return (p->next - p->dot + 3) / 4;
 }
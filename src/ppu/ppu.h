@@ -1,21 +1,61 @@
 #ifndef PPU_H
 #define PPU_H
 
+/**
+ * Scanline PPU
+ *
+ * Each line runs through mode 2 (OAM scan, 80 dots), mode 3 (drawing,
+ * 172 dots) and mode 0 (HBlank) for 456 dots, lines 144-153 are VBlank
+ * (mode 1). A line is rendered into the frame when its mode 3 ends, with
+ * the registers (LCDC, SCX/SCY, WX/WY, BGP, OBP0/1) as they are at that
+ * moment. LY, STAT and the VBlank/STAT interrupts follow the mode changes.
+ *
+ * Sprites for a line are picked from OAM once, when its mode 2 ends (at
+ * most 10, sorted by drawing priority), and drawn over the background.
+ *
+ * Tiles are drawn from a decoded cache of 2-bit color indices, refreshed
+ * for the tiles mem_dirty() reports as written. Decoding and palette
+ * expansion go through the fastest ppu_kernels_t the host supports.
+ */
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdint.h>
 #include "mem.h"
+#include "ppu_simd.h"
+
+#define PPU_MODE_HBLANK (0)
+#define PPU_MODE_VBLANK (1)
+#define PPU_MODE_OAM    (2)
+#define PPU_MODE_DRAW   (3)
+
+#define PPU_TILES       (384)  /* 8000-97FF */
+#define PPU_LINE_OBJS   (10)   /* sprites per line */
 
 typedef struct {
-    uint64_t cycle;
-    uint32_t *frame;
+    uint32_t *frame;     /* 160x144 RGBA */
+    uint32_t dot;        /* dots into the current line, 0-455 */
+    uint32_t next;       /* dot of the next mode change on this line */
+    uint8_t  ly;
+    uint8_t  mode;       /* PPU_MODE_* */
+    uint8_t  stat_line;  /* STAT interrupt line, IF bit 1 is raised on its rising edge */
+    uint8_t  lcd_on;     /* LCDC bit 7, while off only blank frames are counted */
+    uint8_t  win_line;   /* window row, advances on lines that show the window */
+    uint8_t  n_objs;     /* sprites found by the last OAM scan */
+    uint8_t  objs[PPU_LINE_OBJS]; /* their OAM indices, highest priority first */
+    uint64_t frames;     /* completed frames (entries into VBlank) */
+    const ppu_kernels_t *kernels; /* ppu_kernels_best() after ppu_init() */
+
+    /* Decoded tiles: [0] as stored, [1] mirrored horizontally (sprites),
+       8 rows of 8 color indices (0-3) each */
+    uint8_t  tile_px[2][PPU_TILES][64];
 } ppu_t;
 
-void ppu_init(ppu_t *p, uint32_t *frame);
+void ppu_init(ppu_t *p, uint32_t *frame, mem_t *m); /* installs the LY/LYC/STAT handlers */
 void ppu_reset(ppu_t *p);
-void ppu_step(ppu_t *p, uint64_t delta, mem_t *m);
+void ppu_step(ppu_t *p, uint64_t delta, mem_t *m);  /* delta in cpu (M-)cycles */
+uint32_t ppu_cycles_to_event(const ppu_t *p);        /* until the next mode change */
 
 #ifdef __cplusplus
 }
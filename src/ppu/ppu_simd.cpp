@@ -0,0 +1,212 @@
+#include "ppu_simd.h"
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)   /* _pdep_u64 is 64-bit only */
+#define PPU_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+* Scalar reference
+*/
+static void decode_tile_scalar(const uint8_t *data, uint8_t *px, uint8_t *flipped)
+{
+    for (int row = 0; row < 8; ++row) {
+        const uint8_t lo = data[row * 2];
+        const uint8_t hi = data[row * 2 + 1];
+        for (int i = 0; i < 8; ++i) {
+            const int bit = 7 - i;
+            const uint8_t color_id = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
+            px[row * 8 + i] = color_id;
+            flipped[row * 8 + 7 - i] = color_id;
+        }
+    }
+}
+
+static void expand_scalar(const uint8_t *idx, const uint32_t *pal, uint32_t *out, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        out[i] = pal[idx[i] & 3];
+    }
+}
+
+#ifdef PPU_SIMD_X86
+/*
+* SSSE3: bit planes are spread with pshufb (one byte per pixel) and tested
+* against a per-pixel bit mask, two rows per vector. Palette expansion is a
+* pshufb into the 16 byte palette, index * 4 + byte selects the entry.
+*/
+/* Byte i of a spread mask picks the plane byte for output byte i */
+static const uint8_t ssse3_spread[6][16] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2},   /* lo planes, rows r, r + 1 */
+    {1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3, 3, 3},   /* hi planes */
+    {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3},   /* expand: pixels 0-3 ... */
+    {4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7},
+    {8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11},
+    {12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15},
+};
+
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_planes(__m128i lo, __m128i hi, __m128i bits)
+{
+    const __m128i l = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+    const __m128i h = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2));
+    return _mm_or_si128(l, h);
+}
+
+/* Two rows, their lo/hi bytes at the bottom of rows */
+__attribute__((target("ssse3")))
+static inline void ssse3_decode_rows(__m128i rows, uint8_t *px, uint8_t *flipped)
+{
+    const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1,
+                                       (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+    const __m128i bits_rev = _mm_setr_epi8(1, 2, 4, 8, 0x10, 0x20, 0x40, (char)0x80,
+                                           1, 2, 4, 8, 0x10, 0x20, 0x40, (char)0x80);
+    const __m128i lo = _mm_shuffle_epi8(rows, _mm_loadu_si128((const __m128i *)ssse3_spread[0]));
+    const __m128i hi = _mm_shuffle_epi8(rows, _mm_loadu_si128((const __m128i *)ssse3_spread[1]));
+
+    _mm_storeu_si128((__m128i *)px, ssse3_planes(lo, hi, bits));
+    _mm_storeu_si128((__m128i *)flipped, ssse3_planes(lo, hi, bits_rev));
+}
+
+__attribute__((target("ssse3")))
+static void decode_tile_ssse3(const uint8_t *data, uint8_t *px, uint8_t *flipped)
+{
+    const __m128i raw = _mm_loadu_si128((const __m128i *)data);
+
+    ssse3_decode_rows(raw, px, flipped);
+    ssse3_decode_rows(_mm_srli_si128(raw, 4), px + 16, flipped + 16);
+    ssse3_decode_rows(_mm_srli_si128(raw, 8), px + 32, flipped + 32);
+    ssse3_decode_rows(_mm_srli_si128(raw, 12), px + 48, flipped + 48);
+}
+
+__attribute__((target("ssse3")))
+static void expand_ssse3(const uint8_t *idx, const uint32_t *pal, uint32_t *out, int n)
+{
+    const __m128i table = _mm_loadu_si128((const __m128i *)pal);
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i byte = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+    const __m128i spread0 = _mm_loadu_si128((const __m128i *)ssse3_spread[2]);
+    const __m128i spread1 = _mm_loadu_si128((const __m128i *)ssse3_spread[3]);
+    const __m128i spread2 = _mm_loadu_si128((const __m128i *)ssse3_spread[4]);
+    const __m128i spread3 = _mm_loadu_si128((const __m128i *)ssse3_spread[5]);
+
+    for (int i = 0; i < n; i += 16) {
+        /* index * 4 + byte: values < 16, so the 16 bit shift cannot carry */
+        const __m128i v = _mm_slli_epi16(
+            _mm_and_si128(_mm_loadu_si128((const __m128i *)(idx + i)), three), 2);
+        __m128i *dst = (__m128i *)(out + i);
+        _mm_storeu_si128(dst + 0, _mm_shuffle_epi8(table, _mm_add_epi8(_mm_shuffle_epi8(v, spread0), byte)));
+        _mm_storeu_si128(dst + 1, _mm_shuffle_epi8(table, _mm_add_epi8(_mm_shuffle_epi8(v, spread1), byte)));
+        _mm_storeu_si128(dst + 2, _mm_shuffle_epi8(table, _mm_add_epi8(_mm_shuffle_epi8(v, spread2), byte)));
+        _mm_storeu_si128(dst + 3, _mm_shuffle_epi8(table, _mm_add_epi8(_mm_shuffle_epi8(v, spread3), byte)));
+    }
+}
+
+/*
+* AVX2 + BMI2: pdep deposits each plane bit into its own byte (bit 0 in
+* byte 0, i.e. the mirrored order), a byte swap gives the stored order.
+* Expansion is the SSSE3 scheme on 8 pixels per 256 bit vector.
+*/
+__attribute__((target("bmi2")))
+static void decode_tile_bmi2(const uint8_t *data, uint8_t *px, uint8_t *flipped)
+{
+    for (int row = 0; row < 8; ++row) {
+        const uint64_t v = _pdep_u64(data[row * 2], 0x0101010101010101ull) |
+                           _pdep_u64(data[row * 2 + 1], 0x0202020202020202ull);
+        const uint64_t swapped = __builtin_bswap64(v);
+        memcpy(flipped + row * 8, &v, 8);
+        memcpy(px + row * 8, &swapped, 8);
+    }
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(const uint8_t *idx, const uint32_t *pal, uint32_t *out, int n)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pal));
+    const __m256i three = _mm256_set1_epi8(3);
+    const __m256i byte = _mm256_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3,
+                                          0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                            4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+    for (int i = 0; i < n; i += 8) {
+        const __m256i v = _mm256_and_si256(
+            _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *)(idx + i))), three);
+        __m256i sel = _mm256_shuffle_epi8(v, spread);
+        sel = _mm256_add_epi8(_mm256_slli_epi16(sel, 2), byte);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(table, sel));
+    }
+}
+#endif
+
+/*
+* Dispatch. Variants are ordered by preference, the last supported one
+* wins in ppu_kernels_best().
+*/
+static const ppu_kernels_t variants[] = {
+    {"scalar", decode_tile_scalar, expand_scalar},
+#ifdef PPU_SIMD_X86
+    {"ssse3", decode_tile_ssse3, expand_ssse3},
+    {"avx2", decode_tile_bmi2, expand_avx2},
+#endif
+};
+
+#define VARIANT_COUNT ((int)(sizeof(variants) / sizeof(variants[0])))
+
+/* What the host runs, probed once: a bit per usable variant and the best one */
+typedef struct {
+    unsigned supported;
+    const ppu_kernels_t *best;
+} host_kernels_t;
+
+static host_kernels_t probe_host(void)
+{
+    host_kernels_t h = { 1u, &variants[0] };
+
+#ifdef PPU_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        h.supported |= 1u << 1;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+        h.supported |= 1u << 2;
+    }
+#endif
+    for (int n = 0; n < VARIANT_COUNT; ++n) {
+        if (h.supported & (1u << n)) {
+            h.best = &variants[n];
+        }
+    }
+    return h;
+}
+
+/* Function-local static: initialised once, thread-safe */
+static const host_kernels_t *host_kernels(void)
+{
+    static const host_kernels_t host = probe_host();
+    return &host;
+}
+
+static int variant_supported(int n)
+{
+    return (host_kernels()->supported >> n) & 1u;
+}
+
+int ppu_kernels_count(void)
+{
+    return VARIANT_COUNT;
+}
+
+const ppu_kernels_t *ppu_kernels_variant(int n)
+{
+    if (n < 0 || n >= VARIANT_COUNT || !variant_supported(n)) {
+        return NULL;
+    }
+    return &variants[n];
+}
+
+const ppu_kernels_t *ppu_kernels_best(void)
+{
+    return host_kernels()->best;
+}
@@ -0,0 +1,36 @@
+#ifndef PPU_SIMD_H
+#define PPU_SIMD_H
+
+/**
+ * Pixel kernels for the PPU, picked at runtime
+ *
+ * decode_tile turns the 16 bytes of a tile (lo/hi plane per row) into 64
+ * color indices, as stored and mirrored. expand maps color indices
+ * through a 4 entry palette. Every variant produces the same output as
+ * the scalar one, vector variants are only compiled for x86-64 (GCC/Clang
+ * target attributes) and only offered if the cpu supports them.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef void (*ppu_decode_fn)(const uint8_t *data, uint8_t *px, uint8_t *flipped);
+typedef void (*ppu_expand_fn)(const uint8_t *idx, const uint32_t *pal, uint32_t *out, int n);
+
+typedef struct {
+    const char   *name;
+    ppu_decode_fn decode_tile;
+    ppu_expand_fn expand;   /* n must be a multiple of 16 */
+} ppu_kernels_t;
+
+const ppu_kernels_t *ppu_kernels_best(void);
+int ppu_kernels_count(void);                     /* variants compiled in */
+const ppu_kernels_t *ppu_kernels_variant(int n); /* NULL if unsupported by the cpu */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PPU_SIMD_H */
@@ -1,5 +1,11 @@
 #include "rom.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 int load_rom(const char *filename, uint8_t *rom, size_t max_size) {
     FILE *file = fopen(filename, "rb");
@@ -18,4 +24,304 @@ int load_rom(const char *filename, uint8_t *rom, size_t max_size) {
 
     printf("Loaded %zu bytes from %s\n", read_bytes, filename);
     return 0;
-}
\ No newline at end of file
+}
+
+/* Fallback for files that cannot be mapped (pipes, some network file systems) */
+static int rom_read(int fd, rom_t *rom, size_t size)
+{
+    uint8_t *data = (uint8_t *)malloc(size);
+    size_t done = 0;
+
+    if (!data) {
+        return -3;
+    }
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n <= 0) {
+            free(data);
+            return -3;
+        }
+        done += (size_t)n;
+    }
+    rom->data = data;
+    rom->size = size;
+    rom->mapped = 0;
+    return 0;
+}
+
+int rom_map(const char *filename, rom_t *rom)
+{
+    struct stat st;
+    int ret = 0;
+
+    rom->data = NULL;
+    rom->size = 0;
+    rom->mapped = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open ROM file\n");
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        printf("ROM file is empty or read error occurred\n");
+        close(fd);
+        return -2;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+        rom->data = (const uint8_t *)data;
+        rom->size = size;
+        rom->mapped = 1;
+    } else {
+        ret = rom_read(fd, rom, size);
+    }
+    close(fd);     /* the mapping keeps its own reference */
+
+    if (ret == 0) {
+        printf("Mapped %zu bytes from %s\n", size, filename);
+    }
+    return ret;
+}
+
+void rom_unmap(rom_t *rom)
+{
+    if (!rom->data) {
+        return;
+    }
+    if (rom->mapped) {
+        munmap((void *)rom->data, rom->size);
+    } else {
+        free((void *)rom->data);
+    }
+    rom->data = NULL;
+    rom->size = 0;
+    rom->mapped = 0;
+}
+
+/* Cartridge type byte (0x0147) -> mapper, RTC and battery */
+static int rom_cart_type(uint8_t type, mem_cart_t *cart)
+{
+    cart->mbc_type = MEM_MBC_NONE;
+    cart->rtc = 0;
+    cart->battery = 0;
+
+    switch (type) {
+        case 0x00: case 0x08: break;
+        case 0x09:             cart->battery = 1; break;
+        case 0x01: case 0x02:  cart->mbc_type = MEM_MBC1; break;
+        case 0x03:             cart->mbc_type = MEM_MBC1; cart->battery = 1; break;
+        case 0x0F: case 0x10:  cart->mbc_type = MEM_MBC3; cart->rtc = 1; cart->battery = 1; break;
+        case 0x11: case 0x12:  cart->mbc_type = MEM_MBC3; break;
+        case 0x13:             cart->mbc_type = MEM_MBC3; cart->battery = 1; break;
+        case 0x19: case 0x1A: case 0x1C: case 0x1D:
+                               cart->mbc_type = MEM_MBC5; break;
+        case 0x1B: case 0x1E:  cart->mbc_type = MEM_MBC5; cart->battery = 1; break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+/* RAM size byte (0x0149) -> bytes */
+static size_t rom_ram_size(uint8_t code)
+{
+    static const size_t sizes[6] = {0, 2 * 1024, 8 * 1024, 32 * 1024, 128 * 1024, 64 * 1024};
+    return (code < 6) ? sizes[code] : 0;
+}
+
+int rom_parse_header(const uint8_t *data, size_t size, rom_header_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    if (size < 0x0150) {
+        return -1;
+    }
+
+    /* Title is 16 bytes on DMG carts, 15 + CGB flag on later ones */
+    for (int i = 0; i < 16 && data[0x0134 + i] >= 0x20 && data[0x0134 + i] < 0x7F; ++i) {
+        h->title[i] = (char)data[0x0134 + i];
+    }
+
+    h->cart_type = data[0x0147];
+    h->rom_size = (data[0x0148] <= 8) ? ((size_t)0x8000 << data[0x0148]) : 0;
+    h->header_checksum = data[0x014D];
+    h->global_checksum = (data[0x014E] << 8) | data[0x014F];
+
+    uint8_t x = 0;
+    for (int i = 0x0134; i <= 0x014C; ++i) {
+        x = x - data[i] - 1;
+    }
+    h->header_ok = (x == h->header_checksum);
+
+    uint16_t sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (i != 0x014E && i != 0x014F) {
+            sum += data[i];
+        }
+    }
+    h->global_ok = (sum == h->global_checksum);
+
+    h->supported = rom_cart_type(h->cart_type, &h->cart);
+    h->cart.ram_size = (h->cart_type == 0x00) ? 0 : rom_ram_size(data[0x0149]);
+    return 0;
+}
+
+/* CRC-32 (reflected 0xEDB88320) lookup table, built at compile time so
+ * loaders on several threads share it without any initialisation */
+typedef struct {
+    uint32_t v[256];
+} crc32_table_t;
+
+static constexpr crc32_table_t crc32_make_table()
+{
+    crc32_table_t t = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        t.v[i] = c;
+    }
+    return t;
+}
+
+static constexpr crc32_table_t crc32_table = crc32_make_table();
+static_assert(crc32_table.v[1] == 0x77073096u, "CRC-32 table");
+
+uint32_t rom_crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = crc32_table.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/*
+* ROM database: one entry per line, '#' starts a comment, '-' keeps the
+* header value
+*
+*   <crc32 hex>  <cart type byte>  <ram size in KB>  [title]
+*   9f3a1c02     0x13              32                SOME GAME
+*
+* Entries live in an open-addressing table indexed by the CRC.
+*/
+typedef struct {
+    uint32_t crc;
+    int16_t  cart_type;   /* -1: keep */
+    int32_t  ram_kb;      /* -1: keep */
+    uint8_t  used;
+} rom_db_entry_t;
+
+struct rom_db {
+    rom_db_entry_t *slots;
+    size_t          mask;
+};
+
+static rom_db_entry_t *rom_db_slot(const rom_db_t *db, uint32_t crc)
+{
+    size_t i = (crc * 2654435761u) & db->mask;
+
+    while (db->slots[i].used && db->slots[i].crc != crc) {
+        i = (i + 1) & db->mask;
+    }
+    return &db->slots[i];
+}
+
+static int rom_db_field(const char *s, long *value)
+{
+    if (s[0] == '-' && s[1] == '\0') {
+        *value = -1;
+        return 1;
+    }
+    char *end;
+    *value = strtol(s, &end, 0);
+    return *end == '\0' && *value >= 0;
+}
+
+rom_db_t *rom_db_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        printf("Failed to open ROM database %s\n", filename);
+        return NULL;
+    }
+
+    /* Size the table for the number of lines, at most half full */
+    size_t lines = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        lines++;
+    }
+    size_t slots = 16;
+    while (slots < lines * 2) {
+        slots <<= 1;
+    }
+
+    rom_db_t *db = (rom_db_t *)calloc(1, sizeof(rom_db_t));
+    if (!db || !(db->slots = (rom_db_entry_t *)calloc(slots, sizeof(rom_db_entry_t)))) {
+        free(db);
+        fclose(file);
+        return NULL;
+    }
+    db->mask = slots - 1;
+
+    rewind(file);
+    int lineno = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char crc_s[32], type_s[32], ram_s[32];
+        long type, ram;
+
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        int n = sscanf(line, "%31s %31s %31s", crc_s, type_s, ram_s);
+        if (n <= 0) {
+            continue;
+        }
+        if (n != 3 || !rom_db_field(type_s, &type) || !rom_db_field(ram_s, &ram) || type > 0xFF) {
+            printf("%s:%d: malformed entry, skipped\n", filename, lineno);
+            continue;
+        }
+
+        uint32_t crc = (uint32_t)strtoul(crc_s, NULL, 16);
+        rom_db_entry_t *e = rom_db_slot(db, crc);
+        e->crc = crc;
+        e->cart_type = (int16_t)type;
+        e->ram_kb = (int32_t)ram;
+        e->used = 1;
+    }
+    fclose(file);
+    return db;
+}
+
+void rom_db_free(rom_db_t *db)
+{
+    if (db) {
+        free(db->slots);
+        free(db);
+    }
+}
+
+int rom_db_apply(const rom_db_t *db, const rom_t *rom, rom_header_t *h)
+{
+    const rom_db_entry_t *e = rom_db_slot(db, rom_crc32(rom->data, rom->size));
+
+    if (!e->used) {
+        return 0;
+    }
+    if (e->cart_type >= 0) {
+        size_t ram_size = h->cart.ram_size;
+        h->cart_type = (uint8_t)e->cart_type;
+        h->supported = rom_cart_type(h->cart_type, &h->cart);
+        h->cart.ram_size = ram_size;
+    }
+    if (e->ram_kb >= 0) {
+        h->cart.ram_size = (size_t)e->ram_kb * 1024;
+    }
+    return 1;
+}
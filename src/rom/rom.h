@@ -1,5 +1,3 @@
-#include <cstdint>
-#include <cstddef>
 #ifndef ROM_H
 #define ROM_H
 
@@ -10,10 +8,48 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stddef.h>
+#include "mem.h"
+
+/* Read-only cartridge image. rom_map() maps the file MAP_SHARED, so every
+ * instance running the same ROM shares the page-cache pages. */
+typedef struct {
+    const uint8_t *data;
+    size_t         size;    /* file size in bytes */
+    int            mapped;  /* 1: mmap'd, 0: heap copy (mmap not possible) */
+} rom_t;
+
+/* Cartridge header (0x0100-0x014F) */
+typedef struct {
+    char       title[17];
+    uint8_t    cart_type;        /* 0x0147 */
+    size_t     rom_size;         /* from 0x0148 */
+    uint8_t    header_checksum;  /* 0x014D */
+    uint16_t   global_checksum;  /* 0x014E-0x014F, big endian */
+    uint8_t    header_ok;        /* 0x014D matches 0x0134-0x014C */
+    uint8_t    global_ok;        /* 0x014E matches the sum of the image */
+    uint8_t    supported;        /* cart_type has a mapper in mem.cpp */
+    mem_cart_t cart;             /* mapper and RAM for mem_create_cart() */
+} rom_header_t;
+
+/* Quirk database, keyed by the CRC32 of the whole image */
+typedef struct rom_db rom_db_t;
+
 int load_rom(const char *filename, uint8_t *rom, size_t max_size);
 
+int rom_map(const char *filename, rom_t *rom);
+void rom_unmap(rom_t *rom);
+
+int rom_parse_header(const uint8_t *data, size_t size, rom_header_t *h);
+uint32_t rom_crc32(const uint8_t *data, size_t size);
+
+rom_db_t *rom_db_load(const char *filename);
+void rom_db_free(rom_db_t *db);
+int rom_db_apply(const rom_db_t *db, const rom_t *rom, rom_header_t *h); /* 1 if overridden */
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif  // ROM_H
\ No newline at end of file
+#endif  // ROM_H
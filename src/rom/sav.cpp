@@ -0,0 +1,95 @@
+#include "sav.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int sav_open(const char *path, size_t size, sav_t *s)
+{
+    struct stat st;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Failed to open save file %s\n", path);
+        return -1;
+    }
+
+    /* New or short files grow with zeros, longer ones (e.g. an RTC footer
+       written by other emulators) keep their tail */
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, size) != 0)) {
+        printf("Failed to size save file %s\n", path);
+        close(fd);
+        return -2;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        printf("Failed to map save file %s\n", path);
+        close(fd);
+        return -3;
+    }
+
+    s->data = (uint8_t *)data;
+    s->size = size;
+    s->fd = fd;
+    s->policy = SAV_SYNC_EXIT;
+    return 0;
+}
+
+void sav_set_policy(sav_t *s, int policy, uint32_t interval_ms)
+{
+    s->policy = policy;
+    s->interval_ms = interval_ms;
+}
+
+int sav_sync(sav_t *s)
+{
+    if (!s->data || msync(s->data, s->size, MS_ASYNC) != 0) {
+        return -1;
+    }
+    s->pending = 0;
+    s->syncs++;
+    return 0;
+}
+
+int sav_tick(sav_t *s, mem_t *m, uint64_t now_ms)
+{
+    if (mem_eram_dirty(m)) {
+        s->pending = 1;
+    }
+    if (!s->pending || s->policy == SAV_SYNC_EXIT) {
+        return 0;
+    }
+    if (s->policy == SAV_SYNC_INTERVAL && now_ms - s->last_sync_ms < s->interval_ms) {
+        return 0;
+    }
+    s->last_sync_ms = now_ms;
+    return sav_sync(s) == 0;
+}
+
+void sav_close(sav_t *s)
+{
+    if (s->data) {
+        msync(s->data, s->size, MS_SYNC);
+        munmap(s->data, s->size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    s->data = NULL;
+    s->fd = -1;
+}
+
+void sav_path_for(const char *rom_path, char *out, size_t out_size)
+{
+    const char *slash = strrchr(rom_path, '/');
+    const char *dot = strrchr(rom_path, '.');
+    size_t len = (dot && (!slash || dot > slash)) ? (size_t)(dot - rom_path) : strlen(rom_path);
+
+    snprintf(out, out_size, "%.*s.sav", (int)len, rom_path);
+}
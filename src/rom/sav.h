@@ -0,0 +1,49 @@
+#ifndef SAV_H
+#define SAV_H
+
+/**
+ * Battery-backed cartridge RAM, persisted in a .sav file
+ *
+ * The file is mapped MAP_SHARED and handed to mem_create_cart() as the
+ * external RAM, so game writes land in the page cache directly. sav_tick()
+ * decides when to msync() them to disk. The mem_t using the buffer must be
+ * destroyed before sav_close().
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mem.h"
+
+/* Flush policy for sav_tick() */
+#define SAV_SYNC_EXIT     (0)  /* only in sav_close() */
+#define SAV_SYNC_INTERVAL (1)  /* written RAM, at most once per interval */
+#define SAV_SYNC_DIRTY    (2)  /* written RAM, on every tick */
+
+typedef struct {
+    uint8_t *data;         /* ram_size bytes, MAP_SHARED */
+    size_t   size;
+    int      fd;
+    int      policy;       /* SAV_SYNC_* */
+    uint32_t interval_ms;
+    uint64_t last_sync_ms;
+    uint8_t  pending;      /* written since the last msync */
+    uint64_t syncs;        /* statistics */
+} sav_t;
+
+int sav_open(const char *path, size_t size, sav_t *s);
+void sav_set_policy(sav_t *s, int policy, uint32_t interval_ms);
+int sav_tick(sav_t *s, mem_t *m, uint64_t now_ms);  /* 1 if it flushed */
+int sav_sync(sav_t *s);
+void sav_close(sav_t *s);
+
+/* "dir/game.gb" -> "dir/game.sav" */
+void sav_path_for(const char *rom_path, char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SAV_H
@@ -0,0 +1,264 @@
+#include "ctest.h"
+#include "cpu.h"
+#include "cpu_jit.h"
+#include "mem.h"
+
+#define ROM_SIZE (0x8000) // 32KB
+
+/* Copies a routine to WRAM, calls it, patches it and calls it again */
+static const uint8_t smc_program[] = {
+    0x31, 0xFE, 0xDF,   // 0100: LD SP, DFFE
+    0x21, 0x00, 0xC0,   // 0103: LD HL, C000
+    0x11, 0x20, 0x01,   // 0106: LD DE, 0120
+    0x06, 0x08,         // 0109: LD B, 8
+    0x1A,               // 010B: LD A, (DE)     <- copy loop
+    0x22,               // 010C: LD (HL+), A
+    0x13,               // 010D: INC DE
+    0x05,               // 010E: DEC B
+    0x20, 0xFA,         // 010F: JR NZ, copy loop
+    0xCD, 0x00, 0xC0,   // 0111: CALL C000
+    0x3E, 0x3D,         // 0114: LD A, 0x3D (DEC A)
+    0xEA, 0x01, 0xC0,   // 0116: LD (C001), A
+    0xCD, 0x00, 0xC0,   // 0119: CALL C000
+    0xC3, 0x03, 0x01,   // 011C: JP 0103
+    0x00,               // 011F
+    0x78,               // 0120: LD A, B        (copied to C000)
+    0x3C,               // 0121: INC A
+    0x47,               // 0122: LD B, A
+    0xCB, 0x37,         // 0123: SWAP A
+    0x4F,               // 0125: LD C, A
+    0xC9,               // 0126: RET
+};
+
+TEST(cpu_jit_lockstep, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t jit_cpu = {};
+    cpu_t ref_cpu = {};
+
+    for (size_t i = 0; i < sizeof(smc_program); i++) {
+        rom_image[0x0100 + i] = smc_program[i];
+    }
+
+    mem_t *jit_mem = mem_create(rom_image, ROM_SIZE);
+    mem_t *ref_mem = mem_create(rom_image, ROM_SIZE);
+    cpu_jit_t *jit = cpu_jit_create(jit_mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+
+    cpu_reset(&jit_cpu);
+    cpu_reset(&ref_cpu);
+
+    /* One block per round, the interpreter catches up to the same cycle */
+    for (int i = 0; i < 5000 && !ctest_current_failed; i++) {
+        EXPECT_EQ(cpu_jit_run(jit, &jit_cpu, jit_mem, 1), 0);
+        while (ref_cpu.cycles < jit_cpu.cycles) {
+            EXPECT_EQ(cpu_step(&ref_cpu, ref_mem), 0);
+        }
+        EXPECT_EQ(ref_cpu.cycles, jit_cpu.cycles);
+        EXPECT_EQ(ref_cpu.pc, jit_cpu.pc);
+        EXPECT_EQ(ref_cpu.sp, jit_cpu.sp);
+        EXPECT_EQ(ref_cpu.r.af, jit_cpu.r.af);
+        EXPECT_EQ(ref_cpu.r.bc, jit_cpu.r.bc);
+        EXPECT_EQ(ref_cpu.r.de, jit_cpu.r.de);
+        EXPECT_EQ(ref_cpu.r.hl, jit_cpu.r.hl);
+    }
+
+    EXPECT_EQ(mem_read_byte(jit_mem, 0xC001), mem_read_byte(ref_mem, 0xC001));
+    EXPECT_TRUE(cpu_jit_stats(jit)->blocks_compiled > 0);
+    EXPECT_TRUE(cpu_jit_stats(jit)->blocks_invalidated > 0);
+
+    cpu_jit_destroy(jit);
+    mem_reset(jit_mem);
+    mem_reset(ref_mem);
+}
+
+TEST(cpu_jit_oam_dma, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    static const uint8_t program[] = {
+        0xE0, 0x46,         // 0200: LDH (46), A  start OAM DMA
+        0x00,               // 0202: NOP          reads FF (RST 38) under a timed DMA
+        0xC9,               // 0203: RET
+    };
+    cpu_t cpu = {};
+
+    for (size_t i = 0; i < sizeof(program); i++) {
+        rom_image[0x0200 + i] = program[i];
+    }
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+    cpu_reset(&cpu);
+
+    /* Translated while the bus is free */
+    mem_set_dma_mode(mem, MEM_DMA_INSTANT);
+    cpu.pc = 0x0200;
+    cpu.r.a = 0xC0;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu_jit_stats(jit)->blocks_compiled, 1u);
+
+    /* The block stops at the FF46 write, the rest runs off the locked bus */
+    mem_set_dma_mode(mem, MEM_DMA_TIMED);
+    cpu.pc = 0x0200;
+    cpu.sp = 0xFFFE;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.pc, 0x0202);
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.pc, 0x0038);
+    EXPECT_EQ(cpu.sp, 0xFFFC);
+
+    cpu_jit_destroy(jit);
+    mem_reset(mem);
+}
+
+TEST(cpu_jit_illegal_opcode, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    rom_image[0x0100] = 0x04;     // INC B
+    rom_image[0x0101] = 0xDD;     // unused
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+    cpu_reset(&cpu);
+
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 100), -1);
+    EXPECT_EQ(cpu.pc, 0x0101);
+    EXPECT_EQ(cpu.r.b, 0x01);
+
+    cpu_jit_destroy(jit);
+    mem_reset(mem);
+}
+
+TEST(cpu_jit_eram_banks, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    const mem_cart_t cart = {MEM_MBC5, 0, 0, 2 * 0x2000};
+    cpu_t cpu = {};
+
+    mem_t *mem = mem_create_cart(rom_image, ROM_SIZE, &cart);
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+    cpu_reset(&cpu);
+    cpu.sp = 0xDFFE;
+
+    /* A000: INC B; RET in bank 0, DEC B; RET in bank 1 */
+    mem_write_byte(mem, 0x0000, 0x0A);
+    mem_write_byte(mem, 0x4000, 0x01);
+    mem_write_byte(mem, 0xA000, 0x05);
+    mem_write_byte(mem, 0xA001, 0xC9);
+    mem_write_byte(mem, 0x4000, 0x00);
+    mem_write_byte(mem, 0xA000, 0x04);
+    mem_write_byte(mem, 0xA001, 0xC9);
+
+    cpu.pc = 0xA000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0x01);
+
+    /* Another RAM bank is another block */
+    mem_write_byte(mem, 0x4000, 0x01);
+    cpu.pc = 0xA000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0x00);
+    EXPECT_EQ(cpu_jit_stats(jit)->blocks_compiled, 2u);
+
+    /* Disabled RAM reads FF (RST 38), nothing is translated from it */
+    mem_write_byte(mem, 0x0000, 0x00);
+    cpu.pc = 0xA000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.pc, 0x0038);
+    EXPECT_EQ(cpu_jit_stats(jit)->blocks_compiled, 2u);
+
+    cpu_jit_destroy(jit);
+    mem_reset(mem);
+}
+
+static void count_watch(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind)
+{
+    (void)pc; (void)addr; (void)value; (void)kind;
+    ++*(int *)ctx;
+}
+
+TEST(cpu_jit_read_watch, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    static const uint8_t program[] = {
+        0x06, 0x01,         // 0100: LD B, 1
+        0x0E, 0x02,         // 0102: LD C, 2
+        0x18, 0xFA,         // 0104: JR 0100
+    };
+    cpu_t cpu = {};
+    int hits = 0;
+
+    for (size_t i = 0; i < sizeof(program); i++) {
+        rom_image[0x0100 + i] = program[i];
+    }
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+    cpu_reset(&cpu);
+    mem_watch_set_pc(mem, &cpu.pc);
+    EXPECT_TRUE(mem_watch_add(mem, 0x0100, 0x0105, MEM_WATCH_READ, count_watch, &hits) >= 0);
+
+    /* Translating the block looks at its bytes, the guest never loads them */
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 100), 0);
+    EXPECT_EQ(cpu_jit_stats(jit)->blocks_compiled, 1u);
+    EXPECT_EQ(cpu.r.b, 0x01);
+    EXPECT_EQ(hits, 0);
+
+    cpu_jit_destroy(jit);
+    mem_reset(mem);
+}
+
+TEST(cpu_jit_smc_echo, cpu_jit)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_jit_t *jit = cpu_jit_create(mem);
+    if (!jit) {
+        GTEST_SKIP();
+    }
+    cpu_reset(&cpu);
+    cpu.sp = 0xDFFE;
+
+    mem_write_byte(mem, 0xC000, 0x04);  // INC B
+    mem_write_byte(mem, 0xC001, 0xC9);  // RET
+
+    /* Built at C000, patched through E000 */
+    cpu.pc = 0xC000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0x01);
+    mem_write_byte(mem, 0xE000, 0x05);  // DEC B
+    cpu.pc = 0xC000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0x00);
+
+    /* Built at E000, patched through C000 */
+    cpu.pc = 0xE000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0xFF);
+    mem_write_byte(mem, 0xC000, 0x04);
+    cpu.pc = 0xE000;
+    EXPECT_EQ(cpu_jit_run(jit, &cpu, mem, 1), 0);
+    EXPECT_EQ(cpu.r.b, 0x00);
+    EXPECT_TRUE(cpu_jit_stats(jit)->blocks_invalidated >= 2);
+
+    cpu_jit_destroy(jit);
+    mem_reset(mem);
+}
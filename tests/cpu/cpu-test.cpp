@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include "ctest.h"
 #include "cpu.h"
 #include "mem.h"
@@ -473,3 +475,661 @@ TEST(cpu_step_interrupt_handling, cpu_step)
     EXPECT_EQ(mem_read_word(mem, cpu.sp), 0x0100);
     EXPECT_EQ(mem_read_byte(mem, 0xFF0F) & 0x01, 0x00);
 }
+
+TEST(cpu_step_halt, cpu_step)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.sp = 0xC000;
+    cpu.ime = 1;
+    rom_image[cpu.pc] = 0x76;     /* HALT */
+    rom_image[cpu.pc + 1] = 0x00; /* NOP */
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    mem_write_byte(mem, 0xFFFF, 0x01);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.halted, 1);
+    EXPECT_EQ(cpu.pc, 0x0101);
+
+    /* Halted steps skip straight to the next event and run nothing */
+    cpu.event_at = cpu.cycles + 1000;
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.cycles, cpu.event_at);
+    EXPECT_EQ(cpu.pc, 0x0101);
+
+    /* No event known: one cycle at a time */
+    uint64_t cycles = cpu.cycles;
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.cycles, cycles + 1);
+
+    /* V-Blank wakes the cpu and is serviced */
+    mem_write_byte(mem, 0xFF0F, 0x01);
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.halted, 0);
+    EXPECT_EQ(cpu.pc, 0x0040);
+    EXPECT_EQ(mem_read_word(mem, cpu.sp), 0x0101);
+}
+
+TEST(cpu_step_illegal_opcode, cpu_step)
+{
+    static uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    rom_image[0x0100] = 0x00;     /* NOP */
+    rom_image[0x0101] = 0xD3;     /* unused */
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_icache_t *icache = cpu_icache_create();
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu_step(&cpu, mem), -1);
+    EXPECT_EQ(cpu.pc, 0x0101);
+    EXPECT_EQ(cpu.cycles, 1u);
+
+    /* cpu_run stops on it as well, cached or not */
+    for (int cached = 0; cached < 2; ++cached) {
+        cpu.pc = 0x0100;
+        cpu.cycles = 0;
+        cpu.icache = cached ? icache : NULL;
+        EXPECT_EQ(cpu_run(&cpu, mem, 100), -1);
+        EXPECT_EQ(cpu.pc, 0x0101);
+        EXPECT_EQ(cpu.cycles, 1u);
+    }
+
+    cpu_icache_destroy(icache);
+    mem_reset(mem);
+}
+
+TEST(cpu_step_cb_ops, cpu_step)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.r.b = 0x01;
+    cpu.r.hl = 0xC000;
+    rom_image[cpu.pc] = 0xCB;     // BIT 0, B
+    rom_image[cpu.pc + 1] = 0x40;
+    rom_image[cpu.pc + 2] = 0xCB; // RES 0, B
+    rom_image[cpu.pc + 3] = 0x80;
+    rom_image[cpu.pc + 4] = 0xCB; // SET 7, (HL)
+    rom_image[cpu.pc + 5] = 0xFE;
+    rom_image[cpu.pc + 6] = 0xCB; // SWAP (HL)
+    rom_image[cpu.pc + 7] = 0x36;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // BIT 0, B
+    EXPECT_TRUE(!cpu_get_flag(&cpu.r, F_Z));
+    EXPECT_EQ(cpu.cycles, 2);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // RES 0, B
+    EXPECT_EQ(cpu.r.b, 0x00);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // SET 7, (HL)
+    EXPECT_EQ(mem_read_byte(mem, 0xC000), 0x80);
+    EXPECT_EQ(cpu.cycles, 8);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // SWAP (HL)
+    EXPECT_EQ(mem_read_byte(mem, 0xC000), 0x08);
+    EXPECT_EQ(cpu.pc, 0x0108);
+}
+
+TEST(cpu_step_cb_shift, cpu_step)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.r.c = 0x81;
+    cpu.r.e = 0x80;
+    cpu.r.a = 0x01;
+    rom_image[cpu.pc] = 0xCB;     // RL C
+    rom_image[cpu.pc + 1] = 0x11;
+    rom_image[cpu.pc + 2] = 0xCB; // RR C
+    rom_image[cpu.pc + 3] = 0x19;
+    rom_image[cpu.pc + 4] = 0xCB; // SRA E
+    rom_image[cpu.pc + 5] = 0x2B;
+    rom_image[cpu.pc + 6] = 0xCB; // SRL A
+    rom_image[cpu.pc + 7] = 0x3F;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    cpu_set_flag(&cpu.r, F_C, 0);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // RL C
+    EXPECT_EQ(cpu.r.c, 0x02);
+    EXPECT_TRUE(cpu_get_flag(&cpu.r, F_C));
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // RR C
+    EXPECT_EQ(cpu.r.c, 0x81);
+    EXPECT_TRUE(!cpu_get_flag(&cpu.r, F_C));
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // SRA E
+    EXPECT_EQ(cpu.r.e, 0xC0);
+
+    EXPECT_EQ(cpu_step(&cpu, mem), 0); // SRL A
+    EXPECT_EQ(cpu.r.a, 0x00);
+    EXPECT_TRUE(cpu_get_flag(&cpu.r, F_Z));
+    EXPECT_TRUE(cpu_get_flag(&cpu.r, F_C));
+    EXPECT_EQ(cpu.cycles, 8);
+}
+
+TEST(cpu_run_matches_step, cpu_run)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t step_cpu = {};
+    cpu_t run_cpu = {};
+
+    cpu_reset(&step_cpu);
+    rom_image[0x0100] = 0x06; // LD B, d8
+    rom_image[0x0101] = 0x10;
+    rom_image[0x0102] = 0x3C; // INC A      <- loop
+    rom_image[0x0103] = 0xCB; // SWAP A
+    rom_image[0x0104] = 0x37;
+    rom_image[0x0105] = 0x05; // DEC B
+    rom_image[0x0106] = 0x20; // JR NZ, loop
+    rom_image[0x0107] = 0xFA;
+    rom_image[0x0108] = 0x18; // JR -2
+    rom_image[0x0109] = 0xFE;
+
+    mem_t *step_mem = mem_create(rom_image, ROM_SIZE);
+    mem_t *run_mem = mem_create(rom_image, ROM_SIZE);
+
+    for (int i = 0; i < 66; i++) {
+        EXPECT_EQ(cpu_step(&step_cpu, step_mem), 0);
+    }
+
+    cpu_reset(&run_cpu);
+    EXPECT_EQ(cpu_run(&run_cpu, run_mem, step_cpu.cycles), 0);
+    EXPECT_EQ(run_cpu.cycles, step_cpu.cycles);
+    EXPECT_EQ(run_cpu.pc, step_cpu.pc);
+    EXPECT_EQ(run_cpu.r.af, step_cpu.r.af);
+    EXPECT_EQ(run_cpu.r.bc, step_cpu.r.bc);
+}
+
+TEST(cpu_run_flags_materialize, cpu_run)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    rom_image[0x0100] = 0x31; // LD SP, DFFE
+    rom_image[0x0101] = 0xFE;
+    rom_image[0x0102] = 0xDF;
+    rom_image[0x0103] = 0x3E; // LD A, 0x0F
+    rom_image[0x0104] = 0x0F;
+    rom_image[0x0105] = 0xC6; // ADD A, 0x01  -> H
+    rom_image[0x0106] = 0x01;
+    rom_image[0x0107] = 0xF5; // PUSH AF
+    rom_image[0x0108] = 0x37; // SCF
+    rom_image[0x0109] = 0x3E; // LD A, 0x01
+    rom_image[0x010A] = 0x01;
+    rom_image[0x010B] = 0x3D; // DEC A        -> Z N C
+    rom_image[0x010C] = 0xCB; // BIT 0, A     -> Z H C
+    rom_image[0x010D] = 0x47;
+    rom_image[0x010E] = 0xF1; // POP AF, replaces the pending flags
+    rom_image[0x010F] = 0x18; // JR -2
+    rom_image[0x0110] = 0xFE;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    EXPECT_EQ(cpu_run(&cpu, mem, 64), 0);
+    EXPECT_EQ(mem_read_byte(mem, 0xDFFC), 0x20); // F pushed by PUSH AF
+    EXPECT_EQ(cpu.r.af, 0x1020);
+    EXPECT_EQ(cpu.pc, 0x010F);
+
+    /* Same sequence stopping right after BIT */
+    cpu_reset(&cpu);
+    while (cpu.pc != 0x010E) {
+        EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    }
+    EXPECT_EQ(cpu.r.f, F_Z | F_H | F_C);
+}
+
+TEST(cpu_run_interrupt_handling, cpu_run)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.sp = 0xC000;
+    cpu.ime = 1;
+    rom_image[0x0100] = 0x3E; // LD A, 0x01
+    rom_image[0x0101] = 0x01;
+    rom_image[0x0102] = 0xE0; // LDH (0xFF), A  -> IE
+    rom_image[0x0103] = 0xFF;
+    rom_image[0x0104] = 0xE0; // LDH (0x0F), A  -> IF
+    rom_image[0x0105] = 0x0F;
+    rom_image[0x0106] = 0x00; // NOP
+    rom_image[0x0040] = 0x18; // JR -2
+    rom_image[0x0041] = 0xFE;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    EXPECT_EQ(cpu_run(&cpu, mem, 100), 0);
+    EXPECT_EQ(cpu.pc, 0x0040);
+    EXPECT_EQ(cpu.ime, 0);
+    EXPECT_EQ(mem_read_word(mem, cpu.sp), 0x0106);
+    EXPECT_TRUE(cpu.cycles >= 100);
+}
+
+TEST(cpu_run_halt, cpu_run)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    rom_image[0x0100] = 0x76; // HALT, IME is off
+    rom_image[0x0101] = 0x3C; // INC A
+    rom_image[0x0102] = 0x18; // JR -2
+    rom_image[0x0103] = 0xFE;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    mem_write_byte(mem, 0xFFFF, 0x01);
+
+    /* Returns at the scheduled event instead of spinning through the budget */
+    cpu.event_at = 500;
+    EXPECT_EQ(cpu_run(&cpu, mem, 10000), 0);
+    EXPECT_EQ(cpu.halted, 1);
+    EXPECT_EQ(cpu.cycles, 500);
+    EXPECT_EQ(cpu.pc, 0x0101);
+
+    /* No event: the whole budget is idle */
+    EXPECT_EQ(cpu_run(&cpu, mem, 1000), 0);
+    EXPECT_EQ(cpu.cycles, 1500);
+
+    /* A request wakes it without IME, execution continues after HALT */
+    mem_write_byte(mem, 0xFF0F, 0x01);
+    EXPECT_EQ(cpu_run(&cpu, mem, 10), 0);
+    EXPECT_EQ(cpu.halted, 0);
+    EXPECT_EQ(cpu.r.a, 0x02);
+    EXPECT_EQ(cpu.pc, 0x0102);
+}
+
+static void count_watch(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind)
+{
+    (void)pc; (void)addr; (void)value; (void)kind;
+    ++*(int *)ctx;
+}
+
+TEST(cpu_run_idle_loop, cpu_run)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t fast_cpu = {};
+    cpu_t slow_cpu = {};
+
+    rom_image[0x0100] = 0xF0; // LDH A, (0x44)   <- wait for LY
+    rom_image[0x0101] = 0x44;
+    rom_image[0x0102] = 0xFE; // CP 0x90
+    rom_image[0x0103] = 0x90;
+    rom_image[0x0104] = 0x20; // JR NZ, -6
+    rom_image[0x0105] = 0xFA;
+    rom_image[0x0200] = 0x04; // INC B            <- not idle
+    rom_image[0x0201] = 0xF0; // LDH A, (0x44)
+    rom_image[0x0202] = 0x44;
+    rom_image[0x0203] = 0x18; // JR -5
+    rom_image[0x0204] = 0xFB;
+    rom_image[0x0300] = 0xF0; // LDH A, (0x04)   <- wait for DIV
+    rom_image[0x0301] = 0x04;
+    rom_image[0x0302] = 0xFE; // CP 0x90
+    rom_image[0x0303] = 0x90;
+    rom_image[0x0304] = 0x20; // JR NZ, -6
+    rom_image[0x0305] = 0xFA;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    cpu_reset(&fast_cpu);
+    fast_cpu.idleloop.enabled = 1;
+    fast_cpu.event_at = 10000;
+    cpu_reset(&slow_cpu);
+    slow_cpu.event_at = 10000;
+
+    EXPECT_EQ(cpu_run(&fast_cpu, mem, 20000), 0);
+    EXPECT_EQ(cpu_run(&slow_cpu, mem, 20000), 0);
+    EXPECT_EQ(fast_cpu.idleloop.skips, 1);
+    EXPECT_TRUE(fast_cpu.idleloop.skipped > 9000);
+    EXPECT_EQ(slow_cpu.idleloop.skips, 0);
+    /* Whole passes are skipped, so both end in the same state */
+    EXPECT_EQ(fast_cpu.cycles, slow_cpu.cycles);
+    EXPECT_EQ(fast_cpu.pc, slow_cpu.pc);
+    EXPECT_EQ(fast_cpu.r.af, slow_cpu.r.af);
+
+    /* The skip ends with the cpu_run budget, not at a later event */
+    cpu_reset(&fast_cpu);
+    fast_cpu.idleloop.enabled = 1;
+    fast_cpu.event_at = 10000;
+    EXPECT_EQ(cpu_run(&fast_cpu, mem, 3000), 0);
+    EXPECT_EQ(fast_cpu.idleloop.skips, 1);
+    EXPECT_TRUE(fast_cpu.cycles >= 3000 && fast_cpu.cycles < 3000 + 8);
+    EXPECT_EQ(fast_cpu.run_end, UINT64_MAX);
+
+    cpu_reset(&fast_cpu);
+    fast_cpu.idleloop.enabled = 1;
+    fast_cpu.event_at = 10000;
+    fast_cpu.pc = 0x0200;
+    EXPECT_EQ(cpu_run(&fast_cpu, mem, 5000), 0);
+    EXPECT_EQ(fast_cpu.idleloop.skips, 0);
+
+    /* Checking the loop body does not trip read watchpoints on it */
+    int watch_hits = 0;
+    cpu_reset(&fast_cpu);
+    fast_cpu.idleloop.enabled = 1;
+    fast_cpu.event_at = 10000;
+    mem_watch_set_pc(mem, &fast_cpu.pc);
+    const int id = mem_watch_add(mem, 0x0100, 0x0105, MEM_WATCH_READ, count_watch, &watch_hits);
+    EXPECT_EQ(cpu_run(&fast_cpu, mem, 3000), 0);
+    EXPECT_EQ(fast_cpu.idleloop.skips, 1);
+    EXPECT_EQ(watch_hits, 0);
+    mem_watch_remove(mem, id);
+
+    /* DIV changes between PPU events, a loop polling it is never skipped */
+    cpu_reset(&fast_cpu);
+    fast_cpu.idleloop.enabled = 1;
+    fast_cpu.event_at = 10000;
+    fast_cpu.pc = 0x0300;
+    EXPECT_EQ(cpu_run(&fast_cpu, mem, 5000), 0);
+    EXPECT_EQ(fast_cpu.idleloop.skips, 0);
+}
+
+TEST(cpu_icache_matches_uncached, cpu_icache)
+{
+    uint8_t rom_image[ROM_SIZE] = {};
+    cpu_t cached_cpu = {};
+    cpu_t plain_cpu = {};
+
+    rom_image[0x0100] = 0x31; // LD SP, C100
+    rom_image[0x0101] = 0x00;
+    rom_image[0x0102] = 0xC1;
+    rom_image[0x0103] = 0x21; // LD HL, C000
+    rom_image[0x0104] = 0x00;
+    rom_image[0x0105] = 0xC0;
+    rom_image[0x0106] = 0x36; // LD (HL), 0x3C (INC A)
+    rom_image[0x0107] = 0x3C;
+    rom_image[0x0108] = 0x23; // INC HL
+    rom_image[0x0109] = 0x36; // LD (HL), 0xC9 (RET)
+    rom_image[0x010A] = 0xC9;
+    rom_image[0x010B] = 0xCD; // CALL C000
+    rom_image[0x010C] = 0x00;
+    rom_image[0x010D] = 0xC0;
+    rom_image[0x010E] = 0x3E; // LD A, 0x3D (DEC A)
+    rom_image[0x010F] = 0x3D;
+    rom_image[0x0110] = 0xEA; // LD (C000), A
+    rom_image[0x0111] = 0x00;
+    rom_image[0x0112] = 0xC0;
+    rom_image[0x0113] = 0xCD; // CALL C000
+    rom_image[0x0114] = 0x00;
+    rom_image[0x0115] = 0xC0;
+    rom_image[0x0116] = 0xCB; // SWAP A
+    rom_image[0x0117] = 0x37;
+    rom_image[0x0118] = 0x18; // JR -2
+    rom_image[0x0119] = 0xFE;
+
+    mem_t *cached_mem = mem_create(rom_image, ROM_SIZE);
+    mem_t *plain_mem = mem_create(rom_image, ROM_SIZE);
+    cpu_icache_t *icache = cpu_icache_create();
+
+    cpu_reset(&cached_cpu);
+    cpu_reset(&plain_cpu);
+    cached_cpu.icache = icache;
+
+    /* Twice through the cache: first run decodes, second one hits */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 20; i++) {
+            EXPECT_EQ(cpu_step(&cached_cpu, cached_mem), 0);
+            EXPECT_EQ(cpu_step(&plain_cpu, plain_mem), 0);
+            EXPECT_EQ(cached_cpu.pc, plain_cpu.pc);
+            EXPECT_EQ(cached_cpu.r.af, plain_cpu.r.af);
+            EXPECT_EQ(cached_cpu.cycles, plain_cpu.cycles);
+        }
+        EXPECT_EQ(cached_cpu.r.a, 0xC3); // 0x3D, DEC A from patched RAM, SWAP
+        cpu_reset(&cached_cpu);
+        cpu_reset(&plain_cpu);
+        cached_cpu.icache = icache;
+    }
+
+    cpu_icache_destroy(icache);
+}
+
+TEST(cpu_icache_fused_pairs, cpu_icache)
+{
+    static const uint8_t program[] = {
+        0x31, 0xFE, 0xDF,   // 0100: LD SP, DFFE
+        0x21, 0x00, 0xC0,   // 0103: LD HL, C000
+        0x11, 0x00, 0xC1,   // 0106: LD DE, C100
+        0x06, 0x08,         // 0109: LD B, 8
+        0x2A,               // 010B: LD A, (HL+)   <- copy
+        0x12,               // 010C: LD (DE), A
+        0x13,               // 010D: INC DE
+        0x05,               // 010E: DEC B
+        0x20, 0xFA,         // 010F: JR NZ, copy
+        0xF0, 0x44,         // 0111: LDH A, (44)
+        0xE6, 0x03,         // 0113: AND 3
+        0xFE, 0x00,         // 0115: CP 0
+        0x28, 0x01,         // 0117: JR Z, +1
+        0x0C,               // 0119: INC C
+        0xC3, 0x06, 0x01,   // 011A: JP 0106
+    };
+    uint8_t rom_image[ROM_SIZE] = {};
+
+    memcpy(&rom_image[0x0100], program, sizeof(program));
+
+    /* Every budget, so runs also end between the two halves of a pair */
+    for (uint64_t budget = 1; budget < 400; budget += 3) {
+        mem_t *fused_mem = mem_create(rom_image, ROM_SIZE);
+        mem_t *plain_mem = mem_create(rom_image, ROM_SIZE);
+        cpu_icache_t *fused_ic = cpu_icache_create();
+        cpu_icache_t *plain_ic = cpu_icache_create();
+        cpu_t fused_cpu = {};
+        cpu_t plain_cpu = {};
+
+        cpu_icache_fuse(fused_ic, 1);
+        cpu_reset(&fused_cpu);
+        cpu_reset(&plain_cpu);
+        fused_cpu.icache = fused_ic;
+        plain_cpu.icache = plain_ic;
+
+        EXPECT_EQ(cpu_run(&fused_cpu, fused_mem, budget), 0);
+        EXPECT_EQ(cpu_run(&plain_cpu, plain_mem, budget), 0);
+        EXPECT_EQ(fused_cpu.cycles, plain_cpu.cycles);
+        EXPECT_EQ(fused_cpu.pc, plain_cpu.pc);
+        EXPECT_EQ(fused_cpu.r.af, plain_cpu.r.af);
+        EXPECT_EQ(fused_cpu.r.bc, plain_cpu.r.bc);
+        EXPECT_EQ(fused_cpu.r.de, plain_cpu.r.de);
+        EXPECT_EQ(fused_cpu.r.hl, plain_cpu.r.hl);
+
+        cpu_icache_destroy(fused_ic);
+        cpu_icache_destroy(plain_ic);
+        mem_reset(fused_mem);
+        mem_reset(plain_mem);
+    }
+}
+
+TEST(cpu_icache_bank_switch, cpu_icache)
+{
+    static const uint8_t program[] = {
+        0x3E, 0x05,         // 0100: LD A, 5
+        0xEA, 0x00, 0x20,   // 0102: LD (2000), A   -> ROM bank 5
+        0xCD, 0x00, 0x40,   // 0105: CALL 4000
+        0x48,               // 0108: LD C, B
+        0x3C,               // 0109: INC A
+        0xEA, 0x00, 0x20,   // 010A: LD (2000), A   -> ROM bank 6
+        0xCD, 0x00, 0x40,   // 010D: CALL 4000
+        0x18, 0xFE,         // 0110: JR -2
+    };
+    const size_t size = 256 * 1024;
+    uint8_t *rom_image = (uint8_t *)calloc(1, size);
+
+    memcpy(&rom_image[0x0100], program, sizeof(program));
+    rom_image[5 * 0x4000] = 0x06; // LD B, 0x55; RET
+    rom_image[5 * 0x4000 + 1] = 0x55;
+    rom_image[5 * 0x4000 + 2] = 0xC9;
+    rom_image[6 * 0x4000] = 0x06; // LD B, 0x66; RET
+    rom_image[6 * 0x4000 + 1] = 0x66;
+    rom_image[6 * 0x4000 + 2] = 0xC9;
+
+    const mem_cart_t cart = {MEM_MBC1, 0, 0, 0};
+    mem_t *mem = mem_create_cart(rom_image, size, &cart);
+    cpu_icache_t *icache = cpu_icache_create();
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    EXPECT_EQ(cpu_run(&cpu, mem, 200), 0);
+    EXPECT_EQ(cpu.r.c, 0x55);
+    EXPECT_EQ(cpu.r.b, 0x66);
+    EXPECT_EQ(cpu.pc, 0x0110);
+
+    cpu_icache_destroy(icache);
+    mem_reset(mem);
+    free(rom_image);
+}
+
+typedef struct {
+    int      hits;
+    uint16_t pc;
+    uint16_t addr;
+    uint8_t  value;
+} watch_log_t;
+
+static void log_watch(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind)
+{
+    watch_log_t *log = (watch_log_t *)ctx;
+
+    (void)kind;
+    log->hits++;
+    log->pc = pc;
+    log->addr = addr;
+    log->value = value;
+}
+
+TEST(cpu_icache_exec_watch, cpu_icache)
+{
+    static uint8_t rom_image[0x8000];
+    static const uint8_t program[] = {
+        0x06, 0x03,         // 0100: LD B, 3
+        0x05,               // 0102: DEC B       (fused with the JR NZ)
+        0x20, 0xFD,         // 0103: JR NZ, -3
+        0x18, 0xFE,         // 0105: JR -2
+    };
+    watch_log_t log = {};
+
+    memcpy(&rom_image[0x0100], program, sizeof(program));
+    mem_t *mem = mem_create(rom_image, sizeof(rom_image));
+    cpu_icache_t *icache = cpu_icache_create();
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    cpu_icache_fuse(icache, 1);
+    EXPECT_EQ(cpu_run(&cpu, mem, 50), 0);       // loop is cached and fused now
+    EXPECT_EQ(cpu.pc, 0x0105);
+
+    mem_watch_set_pc(mem, &cpu.pc);
+    const int id = mem_watch_add(mem, 0x0103, 0x0103, MEM_WATCH_EXEC, log_watch, &log);
+    EXPECT_TRUE(id >= 0);
+    cpu.pc = 0x0100;
+    EXPECT_EQ(cpu_run(&cpu, mem, 50), 0);
+    EXPECT_EQ(log.hits, 3);
+    EXPECT_EQ(log.pc, 0x0103);
+    EXPECT_EQ(log.addr, 0x0103);
+    EXPECT_EQ(log.value, 0x20);
+
+    mem_watch_remove(mem, id);
+    cpu.pc = 0x0100;
+    EXPECT_EQ(cpu_run(&cpu, mem, 50), 0);
+    EXPECT_EQ(log.hits, 3);
+    EXPECT_EQ(cpu.pc, 0x0105);
+
+    cpu_icache_destroy(icache);
+    mem_reset(mem);
+}
+
+TEST(cpu_icache_read_watch, cpu_icache)
+{
+    static uint8_t rom_image[0x8000];
+    static const uint8_t program[] = {
+        0x06, 0x03,         // 0100: LD B, 3
+        0x21, 0x00, 0xC0,   // 0102: LD HL, C000
+        0x18, 0xFE,         // 0105: JR -2
+    };
+    watch_log_t log = {};
+
+    memcpy(&rom_image[0x0100], program, sizeof(program));
+    mem_t *mem = mem_create(rom_image, sizeof(rom_image));
+    cpu_icache_t *icache = cpu_icache_create();
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    mem_watch_set_pc(mem, &cpu.pc);
+    EXPECT_TRUE(mem_watch_add(mem, 0x0100, 0x0106, MEM_WATCH_READ, log_watch, &log) >= 0);
+
+    /* Decoding operands into the cache is not a data read */
+    EXPECT_EQ(cpu_run(&cpu, mem, 50), 0);
+    EXPECT_EQ(cpu.r.b, 0x03);
+    EXPECT_EQ(cpu.r.hl, 0xC000);
+    EXPECT_EQ(log.hits, 0);
+
+    /* A real load from there still is */
+    cpu.r.hl = 0x0101;
+    mem_write_byte(mem, 0xC000, 0x7E);  // LD A, (HL)
+    mem_write_byte(mem, 0xC001, 0x18);  // JR -2 (to itself)
+    mem_write_byte(mem, 0xC002, 0xFE);
+    cpu.pc = 0xC000;
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.r.a, 0x03);
+    EXPECT_EQ(log.hits, 1);
+    EXPECT_EQ(log.addr, 0x0101);
+
+    cpu_icache_destroy(icache);
+    mem_reset(mem);
+}
+
+TEST(cpu_icache_oam_dma, cpu_icache)
+{
+    static uint8_t rom_image[0x8000];
+    static const uint8_t program[] = {
+        0xE0, 0x46,         // 0200: LDH (46), A  start OAM DMA
+        0x00,               // 0202: NOP          reads FF (RST 38) under a timed DMA
+        0xC9,               // 0203: RET
+    };
+
+    memcpy(&rom_image[0x0200], program, sizeof(program));
+    mem_t *mem = mem_create(rom_image, sizeof(rom_image));
+    cpu_icache_t *icache = cpu_icache_create();
+    cpu_t cpu = {};
+
+    cpu_reset(&cpu);
+    cpu.icache = icache;
+    cpu_icache_fuse(icache, 1);
+
+    /* An instant DMA never locks the bus, the routine gets cached */
+    mem_set_dma_mode(mem, MEM_DMA_INSTANT);
+    cpu.pc = 0x0200;
+    cpu.r.a = 0xC0;
+    EXPECT_EQ(cpu_run(&cpu, mem, 4), 0);
+    EXPECT_EQ(cpu.pc, 0x0203);
+
+    /* A timed one does: the cached NOP must not run */
+    mem_set_dma_mode(mem, MEM_DMA_TIMED);
+    cpu.pc = 0x0200;
+    EXPECT_EQ(cpu_run(&cpu, mem, 4), 0);
+    EXPECT_EQ(cpu.pc, 0x0038);
+    EXPECT_EQ(cpu.sp, 0xFFFC);
+
+    mem_step(mem, 160);
+    EXPECT_EQ(mem_dma_active(mem), 0);
+    cpu.pc = 0x0200;
+    cpu.sp = 0xFFFE;
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_TRUE(mem_dma_active(mem));
+    EXPECT_EQ(cpu_step(&cpu, mem), 0);
+    EXPECT_EQ(cpu.pc, 0x0038);
+
+    cpu_icache_destroy(icache);
+    mem_reset(mem);
+}
@@ -0,0 +1,477 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ctest.h"
+#include "mem.h"
+
+#define ROM_SIZE (0x8000) // 32KB
+
+static int code_writes;
+
+static void count_code_write(void *ctx, uint16_t addr)
+{
+    (void)ctx;
+    (void)addr;
+    code_writes++;
+}
+
+/* Test I/O handler: reads return ctx's counter, writes store the inverse */
+static uint8_t count_io_read(void *ctx, mem_t *m, uint8_t reg)
+{
+    (void)m;
+    (void)reg;
+    return ++*(uint8_t *)ctx;
+}
+
+static void invert_io_write(void *ctx, mem_t *m, uint8_t reg, uint8_t value)
+{
+    (void)ctx;
+    mem_io_regs(m)[reg] = ~value;
+}
+
+TEST(mem_page_map, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+
+    rom_image[0x0150] = 0x12;
+    rom_image[0x7FFF] = 0x34;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    /* ROM through the page table, writes are dropped */
+    EXPECT_EQ(mem_read_byte(mem, 0x0150), 0x12);
+    mem_write_byte(mem, 0x0150, 0xAA);
+    EXPECT_EQ(mem_read_byte(mem, 0x0150), 0x12);
+
+    /* WRAM and its echo share the pages */
+    mem_write_byte(mem, 0xC123, 0x56);
+    EXPECT_EQ(mem_read_byte(mem, 0xE123), 0x56);
+    mem_write_byte(mem, 0xFDFF, 0x78);
+    EXPECT_EQ(mem_read_byte(mem, 0xDDFF), 0x78);
+
+    /* Last cartridge RAM byte */
+    mem_write_byte(mem, 0xBFFF, 0x9A);
+    EXPECT_EQ(mem_read_byte(mem, 0xBFFF), 0x9A);
+
+    /* OAM, unusable area and I/O go through the slow path */
+    mem_write_byte(mem, 0xFE9F, 0x11);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE9F), 0x11);
+    EXPECT_EQ(mem_read_byte(mem, 0xFEA0), 0xFF);
+    *mem_events(mem) = 0;
+    mem_write_byte(mem, 0xFF0F, 0x01);
+    EXPECT_EQ(*mem_events(mem), MEM_EV_IRQ);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF0F), 0x01);
+
+    /* Code pages leave the fast write path but still store the byte */
+    code_writes = 0;
+    mem_set_code_hook(mem, count_code_write, NULL);
+    mem_mark_code_page(mem, 0xC1, 1);
+    mem_write_byte(mem, 0xC000, 0x01);
+    mem_write_byte(mem, 0xC100, 0x02);
+    EXPECT_EQ(code_writes, 1);
+    EXPECT_EQ(mem_read_byte(mem, 0xC100), 0x02);
+
+    mem_mark_code_page(mem, 0xC1, 0);
+    mem_write_byte(mem, 0xC100, 0x03);
+    EXPECT_EQ(code_writes, 1);
+    EXPECT_EQ(mem_read_byte(mem, 0xC100), 0x03);
+
+    mem_reset(mem);
+}
+
+/* Banked image, the first byte of every 16K bank holds its bank number */
+static uint8_t *make_cart(size_t size)
+{
+    uint8_t *rom = (uint8_t *)calloc(1, size);
+
+    for (size_t bank = 0; bank < size / 0x4000; ++bank) {
+        rom[bank * 0x4000] = (uint8_t)bank;
+        rom[bank * 0x4000 + 1] = (uint8_t)(bank >> 8);
+    }
+    return rom;
+}
+
+TEST(mem_mbc1_banking, mem_mbc)
+{
+    const mem_cart_t cart = {MEM_MBC1, 0, 1, 32 * 1024};
+    uint8_t *rom = make_cart(1024 * 1024);
+    mem_t *mem = mem_create_cart(rom, 1024 * 1024, &cart);
+
+    EXPECT_EQ(mem_mbc_type(mem), MEM_MBC1);
+    EXPECT_EQ(mem_rom_bank(mem), 1);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 1);
+
+    /* Bank 0 selects bank 1, upper bits come from 4000–5FFF */
+    mem_write_byte(mem, 0x2000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 1);
+    mem_write_byte(mem, 0x2000, 0x05);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 5);
+    *mem_events(mem) = 0;
+    mem_write_byte(mem, 0x4000, 0x01);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 0x25);
+    EXPECT_EQ(*mem_events(mem) & MEM_EV_BANK, MEM_EV_BANK);
+
+    /* RAM is disabled until 0x0A is written to 0000–1FFF */
+    mem_write_byte(mem, 0xA000, 0x11);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0xFF);
+    mem_write_byte(mem, 0x0000, 0x0A);
+    mem_write_byte(mem, 0xA000, 0x11);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0x11);
+
+    /* Mode 1 moves bank 0 and selects the RAM bank */
+    mem_write_byte(mem, 0x6000, 0x01);
+    EXPECT_EQ(mem_rom_bank0(mem), 0x20);
+    EXPECT_EQ(mem_read_byte(mem, 0x0000), 0x20);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0x00);
+    mem_write_byte(mem, 0xA000, 0x22);
+    mem_write_byte(mem, 0x6000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0x0000), 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0x11);
+
+    mem_write_byte(mem, 0x0000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0xFF);
+
+    mem_reset(mem);
+    free(rom);
+}
+
+TEST(mem_mbc3_rtc, mem_mbc)
+{
+    const mem_cart_t cart = {MEM_MBC3, 1, 1, 32 * 1024};
+    uint8_t *rom = make_cart(128 * 1024);
+    mem_t *mem = mem_create_cart(rom, 128 * 1024, &cart);
+
+    EXPECT_EQ(mem_mbc_type(mem), MEM_MBC3);
+    mem_write_byte(mem, 0x2000, 0x07);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 7);
+    mem_write_byte(mem, 0x0000, 0x0A);
+
+    /* 23:59:59 on day 511 */
+    const uint8_t start[5] = {59, 59, 23, 0xFF, 0x01};
+    for (uint8_t reg = 0; reg < 5; ++reg) {
+        mem_write_byte(mem, 0x4000, 0x08 + reg);
+        mem_write_byte(mem, 0xA000, start[reg]);
+    }
+    mem_rtc_advance(mem, 2);
+
+    /* Latched registers only change on a 0 -> 1 write */
+    mem_write_byte(mem, 0x6000, 0x00);
+    mem_write_byte(mem, 0x6000, 0x01);
+    mem_rtc_advance(mem, 60);
+
+    mem_write_byte(mem, 0x4000, 0x08);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 1);
+    mem_write_byte(mem, 0x4000, 0x0A);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0);
+    mem_write_byte(mem, 0x4000, 0x0B);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0);
+    mem_write_byte(mem, 0x4000, 0x0C);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 0x80);   // day carry
+
+    /* Halt stops the clock */
+    mem_write_byte(mem, 0xA000, 0x40);
+    mem_rtc_advance(mem, 3600);
+    mem_write_byte(mem, 0x6000, 0x00);
+    mem_write_byte(mem, 0x6000, 0x01);
+    mem_write_byte(mem, 0x4000, 0x09);
+    EXPECT_EQ(mem_read_byte(mem, 0xA000), 1);
+
+    /* Back to RAM bank 2 */
+    mem_write_byte(mem, 0x4000, 0x02);
+    mem_write_byte(mem, 0xB000, 0x5A);
+    mem_write_byte(mem, 0x4000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xB000), 0x00);
+    mem_write_byte(mem, 0x4000, 0x02);
+    EXPECT_EQ(mem_read_byte(mem, 0xB000), 0x5A);
+
+    mem_reset(mem);
+    free(rom);
+}
+
+TEST(mem_mbc5_banking, mem_mbc)
+{
+    const size_t size = 8 * 1024 * 1024;
+    const mem_cart_t cart = {MEM_MBC5, 0, 1, 128 * 1024};
+    uint8_t *rom = make_cart(size);
+    mem_t *mem = mem_create_cart(rom, size, &cart);
+
+    EXPECT_EQ(mem_mbc_type(mem), MEM_MBC5);
+
+    /* 9-bit ROM bank, bank 0 is selectable */
+    mem_write_byte(mem, 0x2000, 0x34);
+    mem_write_byte(mem, 0x3000, 0x01);
+    EXPECT_EQ(mem_rom_bank(mem), 0x134);
+    EXPECT_EQ(mem_read_word(mem, 0x4000), 0x134);
+    mem_write_byte(mem, 0x2000, 0x00);
+    mem_write_byte(mem, 0x3000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0x4000), 0);
+
+    /* 16 RAM banks */
+    mem_write_byte(mem, 0x0000, 0x0A);
+    mem_write_byte(mem, 0x4000, 0x0F);
+    mem_write_byte(mem, 0xBFFF, 0x77);
+    mem_write_byte(mem, 0x4000, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xBFFF), 0x00);
+    mem_write_byte(mem, 0x4000, 0x0F);
+    EXPECT_EQ(mem_read_byte(mem, 0xBFFF), 0x77);
+
+    mem_reset(mem);
+    free(rom);
+}
+
+TEST(mem_io_dispatch, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    uint8_t reads = 0;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    /* Unhandled registers are plain storage, also through mem_io_regs */
+    mem_write_byte(mem, 0xFF42, 0x12);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF42), 0x12);
+    mem_io_regs(mem)[0x43] = 0x34;
+    EXPECT_EQ(mem_read_byte(mem, 0xFF43), 0x34);
+
+    mem_io_register(mem, 0x42, count_io_read, invert_io_write, &reads);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF42), 1);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF42), 2);
+    mem_write_byte(mem, 0xFF42, 0x0F);
+    EXPECT_EQ(mem_io_regs(mem)[0x42], 0xF0);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF43), 0x34);    // neighbours untouched
+
+    /* Write-only handler keeps the default read */
+    mem_io_register(mem, 0x42, NULL, invert_io_write, NULL);
+    mem_write_byte(mem, 0xFF42, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF42), 0xFF);
+
+    mem_io_register(mem, 0x42, NULL, NULL, NULL);
+    mem_write_byte(mem, 0xFF42, 0x55);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF42), 0x55);
+    EXPECT_EQ(reads, 2);
+
+    /* IF keeps raising the interrupt event, HRAM is not I/O */
+    *mem_events(mem) = 0;
+    mem_write_byte(mem, 0xFF80, 0x01);
+    EXPECT_EQ(*mem_events(mem), 0);
+    mem_write_byte(mem, 0xFF0F, 0x04);
+    EXPECT_EQ(*mem_events(mem), MEM_EV_IRQ);
+
+    mem_reset(mem);
+}
+
+typedef struct {
+    uint8_t data[8192];
+    size_t  len;
+    int     calls;
+} serial_capture_t;
+
+static void capture_serial(void *ctx, const uint8_t *data, size_t len)
+{
+    serial_capture_t *c = (serial_capture_t *)ctx;
+
+    memcpy(c->data + c->len, data, len);
+    c->len += len;
+    c->calls++;
+}
+
+static void send_serial(mem_t *mem, uint8_t c)
+{
+    mem_write_byte(mem, 0xFF01, c);
+    mem_write_byte(mem, 0xFF02, 0x81);
+}
+
+TEST(mem_serial_sink, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static serial_capture_t out;
+    uint8_t buf[16];
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    /* Capture mode: nothing leaves the buffer until it is read */
+    mem_serial_sink(mem, NULL, NULL);
+    send_serial(mem, 'o');
+    send_serial(mem, 'k');
+    mem_write_byte(mem, 0xFF02, 0x80);          // external clock, no transfer
+    mem_serial_flush(mem);
+    EXPECT_EQ(mem_serial_read(mem, buf, sizeof(buf)), 2);
+    EXPECT_EQ(memcmp(buf, "ok", 2), 0);
+    EXPECT_EQ(mem_serial_read(mem, buf, sizeof(buf)), 0);
+
+    /* Full capture buffer keeps the newest bytes */
+    for (int i = 0; i < 4096 + 3; ++i) {
+        send_serial(mem, (uint8_t)i);
+    }
+    EXPECT_EQ(mem_serial_read(mem, buf, 1), 1);
+    EXPECT_EQ(buf[0], 3);
+
+    /* Sink mode: captured bytes go to the new sink on the next flush */
+    mem_serial_sink(mem, capture_serial, &out);
+    EXPECT_EQ(out.len, 0);
+    mem_serial_flush(mem);
+    EXPECT_EQ(out.len, 4095);
+    EXPECT_EQ(out.data[0], 4);
+    out.len = 0;
+    out.calls = 0;
+    for (int i = 0; i < 5000; ++i) {
+        send_serial(mem, 'a' + (i % 26));
+    }
+    EXPECT_EQ(out.calls, 1);                    // one full buffer
+    EXPECT_EQ(out.len, 4096);
+    mem_reset(mem);                             // flushes the rest
+    EXPECT_EQ(out.len, 5000);
+    EXPECT_EQ(out.data[4999], 'a' + (4999 % 26));
+}
+
+TEST(mem_oam_dma, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+
+    rom_image[0x1234] = 0x42;
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    for (int i = 0; i < 160; ++i) {
+        mem_write_byte(mem, 0xC100 + i, (uint8_t)(i + 1));
+    }
+
+    /* Timed: one byte per M-cycle, only FF00-FFFF reachable meanwhile */
+    mem_write_byte(mem, 0xFF80, 0x77);
+    mem_write_byte(mem, 0xFF46, 0xC1);
+    EXPECT_EQ(mem_dma_active(mem), 1);
+    EXPECT_EQ(mem_read_byte(mem, 0x1234), 0xFF);
+    EXPECT_EQ(mem_read_byte(mem, 0xC100), 0xFF);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF80), 0x77);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF46), 0xC1);
+    mem_write_byte(mem, 0xC100, 0xEE);          // dropped
+
+    mem_step(mem, 10);
+    EXPECT_EQ(mem_dma_active(mem), 1);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE00), 0xFF);  // OAM is locked too
+    mem_step(mem, 149);
+    EXPECT_EQ(mem_dma_active(mem), 1);
+    mem_step(mem, 1);
+    EXPECT_EQ(mem_dma_active(mem), 0);
+    EXPECT_EQ(mem_read_byte(mem, 0x1234), 0x42);
+    EXPECT_EQ(mem_read_byte(mem, 0xC100), 0x01);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE00), 0x01);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE9F), 160);
+
+    /* Instant: copied at the write, from the WRAM echo for E1 */
+    mem_set_dma_mode(mem, MEM_DMA_INSTANT);
+    mem_write_byte(mem, 0xC100, 0x99);
+    mem_write_byte(mem, 0xFF46, 0xE1);
+    EXPECT_EQ(mem_dma_active(mem), 0);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE00), 0x99);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE01), 0x02);
+
+    mem_reset(mem);
+}
+
+TEST(mem_vram_dirty, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    const mem_dirty_t *d = mem_dirty(mem);
+
+    EXPECT_EQ(d->oam, (1ull << 40) - 1);
+    mem_dirty_clear(mem, NULL);
+    EXPECT_EQ(d->tiles[0] | d->tiles[5] | d->map_rows | d->oam, 0);
+
+    mem_write_byte(mem, 0x8000, 0x00);          // unchanged: stays clean
+    EXPECT_EQ(d->tiles[0], 0);
+
+    mem_write_byte(mem, 0x801F, 0x12);          // tile 1
+    mem_write_byte(mem, 0x97F0, 0x34);          // tile 383
+    mem_write_byte(mem, 0x9800, 0x01);          // map 0, row 0
+    mem_write_byte(mem, 0x9FFF, 0x02);          // map 1, row 31
+    mem_write_byte(mem, 0xFE9C, 0x03);          // sprite 39
+    EXPECT_EQ(d->tiles[0], 1ull << 1);
+    EXPECT_EQ(d->tiles[5], 1ull << 63);
+    EXPECT_EQ(d->map_rows, 1ull | (1ull << 63));
+    EXPECT_EQ(d->oam, 1ull << 39);
+    EXPECT_EQ(mem_read_byte(mem, 0x801F), 0x12);
+    EXPECT_EQ(mem_read_byte(mem, 0x9FFF), 0x02);
+
+    /* Partial clear keeps the other bits */
+    mem_dirty_t handled = {};
+    handled.tiles[0] = 1ull << 1;
+    mem_dirty_clear(mem, &handled);
+    EXPECT_EQ(d->tiles[0], 0);
+    EXPECT_EQ(d->tiles[5], 1ull << 63);
+    EXPECT_EQ(d->oam, 1ull << 39);
+
+    /* OAM DMA only marks the sprites it changes */
+    mem_dirty_clear(mem, NULL);
+    mem_set_dma_mode(mem, MEM_DMA_INSTANT);
+    mem_write_byte(mem, 0xC000 + 9, 0x55);      // sprite 2
+    mem_write_byte(mem, 0xC000 + 0x9C, 0x03);   // same as OAM already
+    mem_write_byte(mem, 0xFF46, 0xC0);
+    EXPECT_EQ(d->oam, 1ull << 2);
+    EXPECT_EQ(mem_read_byte(mem, 0xFE09), 0x55);
+
+    mem_reset(mem);
+}
+
+typedef struct {
+    int     reads;
+    int     writes;
+    uint8_t value;
+} watch_count_t;
+
+static void count_watch(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind)
+{
+    watch_count_t *c = (watch_count_t *)ctx;
+
+    (void)pc;
+    (void)addr;
+    if (kind == MEM_WATCH_READ) {
+        c->reads++;
+    } else if (kind == MEM_WATCH_WRITE) {
+        c->writes++;
+    }
+    c->value = value;
+}
+
+TEST(mem_watchpoints, mem_map)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    watch_count_t c = {};
+
+    rom_image[0x1234] = 0x42;
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+
+    const int rom = mem_watch_add(mem, 0x1234, 0x1234, MEM_WATCH_READ, count_watch, &c);
+    const int ram = mem_watch_add(mem, 0xC010, 0xC01F, MEM_WATCH_READ | MEM_WATCH_WRITE,
+                                  count_watch, &c);
+    EXPECT_TRUE(rom >= 0 && ram >= 0);
+    EXPECT_EQ(mem_watch_add(mem, 0xC000, 0xC000, 0, count_watch, &c), -1);
+
+    /* Watched page, outside the range: slow path but no hit */
+    EXPECT_EQ(mem_read_byte(mem, 0x1235), 0x00);
+    EXPECT_EQ(c.reads, 0);
+    EXPECT_EQ(mem_read_byte(mem, 0x1234), 0x42);
+    EXPECT_EQ(c.reads, 1);
+    EXPECT_EQ(c.value, 0x42);
+    EXPECT_EQ(mem_fetch_byte(mem, 0x1234), 0x42);   // not a read
+    EXPECT_EQ(c.reads, 1);
+
+    mem_write_byte(mem, 0xC00F, 0x01);
+    mem_write_byte(mem, 0xC010, 0x02);
+    mem_write_byte(mem, 0xC100, 0x03);              // other page
+    EXPECT_EQ(c.writes, 1);
+    EXPECT_EQ(c.value, 0x02);
+    EXPECT_EQ(mem_read_byte(mem, 0xC010), 0x02);
+    EXPECT_EQ(mem_read_byte(mem, 0xE010), 0x02);    // echo: other address, no hit
+    EXPECT_EQ(c.reads, 2);                          // only the watched address
+    EXPECT_EQ(mem_read_byte(mem, 0xC100), 0x03);
+
+    /* Removing restores plain storage */
+    mem_watch_remove(mem, ram);
+    mem_write_byte(mem, 0xC010, 0x04);
+    EXPECT_EQ(mem_read_byte(mem, 0xC010), 0x04);
+    EXPECT_EQ(c.writes, 1);
+    mem_watch_remove(mem, rom);
+    EXPECT_EQ(mem_read_byte(mem, 0x1234), 0x42);
+    EXPECT_EQ(c.reads, 2);
+
+    mem_reset(mem);
+}
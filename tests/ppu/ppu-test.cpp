@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ctest.h"
+#include "mem.h"
+#include "ppu.h"
+
+#define ROM_SIZE        (0x8000)
+#define CYCLES_PER_LINE (114)   // 456 dots
+
+static uint8_t read_if(mem_t *mem)
+{
+    return mem_read_byte(mem, 0xFF0F);
+}
+
+static void count_watch(void *ctx, uint16_t pc, uint16_t addr, uint8_t value, uint8_t kind)
+{
+    (void)pc; (void)addr; (void)value; (void)kind;
+    ++*(int *)ctx;
+}
+
+TEST(ppu_mode_timing, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    ppu_init(&ppu, frame, mem);
+
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_OAM);
+    EXPECT_EQ(ppu_cycles_to_event(&ppu), 20);
+    ppu_step(&ppu, 19, mem);
+    EXPECT_EQ(ppu.mode, PPU_MODE_OAM);
+    ppu_step(&ppu, 1, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_DRAW);
+    EXPECT_EQ(ppu_cycles_to_event(&ppu), 43);
+    ppu_step(&ppu, 43, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_HBLANK);
+    ppu_step(&ppu, 50, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 0);
+    ppu_step(&ppu, 1, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 1);
+    EXPECT_EQ(ppu.mode, PPU_MODE_OAM);
+
+    /* Big steps cross several modes and lines at once */
+    ppu_step(&ppu, 142 * CYCLES_PER_LINE + 113, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 143);
+    EXPECT_EQ(read_if(mem) & 0x01, 0);
+    ppu_step(&ppu, 1, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 144);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_VBLANK);
+    EXPECT_EQ(read_if(mem) & 0x01, 0x01);
+    EXPECT_EQ(ppu.frames, 1u);
+    EXPECT_EQ(ppu_cycles_to_event(&ppu), CYCLES_PER_LINE);
+
+    ppu_step(&ppu, 10 * CYCLES_PER_LINE, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 0);
+    EXPECT_EQ(ppu.mode, PPU_MODE_OAM);
+
+    /* LY is read-only */
+    mem_write_byte(mem, 0xFF44, 0x55);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 0);
+
+    /* The PPU raising IF is not a store the cpu made */
+    int if_writes = 0;
+    mem_write_byte(mem, 0xFF0F, 0);
+    *mem_events(mem) = 0;
+    EXPECT_TRUE(mem_watch_add(mem, 0xFF0F, 0xFF0F, MEM_WATCH_WRITE, count_watch, &if_writes) >= 0);
+    ppu_step(&ppu, 144 * CYCLES_PER_LINE, mem);
+    EXPECT_EQ(read_if(mem) & 0x01, 0x01);
+    EXPECT_TRUE(*mem_events(mem) & MEM_EV_IRQ);
+    EXPECT_EQ(if_writes, 0);
+
+    mem_reset(mem);
+}
+
+TEST(ppu_stat_irq, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    ppu_init(&ppu, frame, mem);
+
+    /* LYC=LY: flag and one interrupt when line 5 starts */
+    mem_write_byte(mem, 0xFF45, 5);
+    mem_write_byte(mem, 0xFF41, 0x40 | 0x07);   // low bits are read-only
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41), 0x80 | 0x40 | PPU_MODE_OAM);
+    ppu_step(&ppu, 5 * CYCLES_PER_LINE - 1, mem);
+    EXPECT_EQ(read_if(mem) & 0x02, 0);
+    ppu_step(&ppu, 1, mem);
+    EXPECT_EQ(read_if(mem) & 0x02, 0x02);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x04, 0x04);
+    mem_write_byte(mem, 0xFF0F, 0);
+    ppu_step(&ppu, 60, mem);                    // still line 5: no new edge
+    EXPECT_EQ(read_if(mem) & 0x02, 0);
+
+    /* Writing LYC to the current line raises it right away */
+    mem_write_byte(mem, 0xFF45, 0);
+    mem_write_byte(mem, 0xFF45, 5);
+    EXPECT_EQ(read_if(mem) & 0x02, 0x02);
+
+    /* HBlank source: once per line */
+    mem_write_byte(mem, 0xFF45, 0xFF);
+    mem_write_byte(mem, 0xFF41, 0x08);
+    mem_write_byte(mem, 0xFF0F, 0);
+    int hblank_irqs = 0;
+    for (int i = 0; i < 3 * CYCLES_PER_LINE; ++i) {
+        ppu_step(&ppu, 1, mem);
+        if (read_if(mem) & 0x02) {
+            hblank_irqs++;
+            mem_write_byte(mem, 0xFF0F, 0);
+        }
+    }
+    EXPECT_EQ(hblank_irqs, 3);
+
+    mem_reset(mem);
+}
+
+TEST(ppu_render_scanlines, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    ppu_init(&ppu, frame, mem);
+
+    /* Tile 1: every row color 3, tile 0 stays color 0 */
+    for (int i = 0; i < 16; ++i) {
+        mem_write_byte(mem, 0x8010 + i, 0xFF);
+    }
+    mem_write_byte(mem, 0x9800, 0x01);          // map (0, 0)
+
+    /* Line 0 is drawn when its mode 3 ends, not before */
+    frame[0] = 0;
+    ppu_step(&ppu, 20 + 42, mem);
+    EXPECT_EQ(frame[0], 0u);
+    ppu_step(&ppu, 1, mem);
+    EXPECT_EQ(frame[0], 0x000000FFu);
+    EXPECT_EQ(frame[8], 0xFFFFFFFFu);
+
+    /* Raster effect: the map changes while line 3 is in HBlank */
+    ppu_step(&ppu, 3 * CYCLES_PER_LINE, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 3);
+    mem_write_byte(mem, 0x9800, 0x00);
+    mem_write_byte(mem, 0x9801, 0x01);
+    ppu_step(&ppu, 5 * CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[3 * 160], 0x000000FFu);     // drawn before the change
+    EXPECT_EQ(frame[4 * 160], 0xFFFFFFFFu);
+    EXPECT_EQ(frame[4 * 160 + 8], 0x000000FFu);
+
+    mem_reset(mem);
+}
+
+TEST(ppu_tile_cache, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    static ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    mem_write_byte(mem, 0x8000, 0x80);          // tile 0, row 0: pixel 0 color 1
+    mem_dirty_clear(mem, NULL);                 // consumed before the PPU existed
+    ppu_init(&ppu, frame, mem);
+    mem_write_byte(mem, 0xFF47, 0xE4);          // identity BGP
+    EXPECT_EQ(ppu.tile_px[0][0][0], 1);
+    EXPECT_EQ(ppu.tile_px[1][0][7], 1);         // mirrored copy
+
+    /* Row 1 of tile 383: lo 0x0F, hi 0x03 -> 0 0 0 0 1 1 3 3 */
+    mem_write_byte(mem, 0x97F2, 0x0F);
+    mem_write_byte(mem, 0x97F3, 0x03);
+    ppu_step(&ppu, 20 + 43, mem);               // line 0 drawn, cache refreshed
+    static const uint8_t row[8] = {0, 0, 0, 0, 1, 1, 3, 3};
+    EXPECT_EQ(memcmp(ppu.tile_px[0][383] + 8, row, 8), 0);
+    for (int i = 0; i < 8; ++i) {
+        EXPECT_EQ(ppu.tile_px[1][383][8 + i], row[7 - i]);
+    }
+    EXPECT_EQ(mem_dirty(mem)->tiles[5], 0);
+    EXPECT_EQ(frame[0], 0xAAAAAAFFu);
+
+    /* A tile change mid-frame shows from the next line on */
+    mem_write_byte(mem, 0x8002, 0xFF);          // tile 0, row 1: color 1
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[160 + 3], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[3], 0xFFFFFFFFu);
+
+    mem_reset(mem);
+}
+
+TEST(ppu_lcdc_scroll_window, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    static ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    ppu_init(&ppu, frame, mem);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF40), 0x91);
+
+    /* Tile 1 at 8010 is color 1, tile 1 at 9010 (signed) is color 2 */
+    for (int i = 0; i < 16; i += 2) {
+        mem_write_byte(mem, 0x8010 + i, 0xFF);
+        mem_write_byte(mem, 0x9011 + i, 0xFF);
+    }
+    mem_write_byte(mem, 0xFF47, 0xE4);
+
+    /* SCX 4: map column 0 shows its right half at x 0..3 */
+    mem_write_byte(mem, 0x9800, 0x01);
+    mem_write_byte(mem, 0xFF43, 4);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[3], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[4], 0xFFFFFFFFu);
+
+    /* SCY 8 on line 1 reads map row 1, wrapping SCX back to 0 */
+    mem_write_byte(mem, 0xFF43, 0);
+    mem_write_byte(mem, 0xFF42, 8);
+    mem_write_byte(mem, 0x9820, 0x01);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[160], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[160 + 8], 0xFFFFFFFFu);
+
+    /* Signed tile data from 9000 and map 9C00 */
+    mem_write_byte(mem, 0xFF42, 0);
+    mem_write_byte(mem, 0x9C00, 0x01);
+    mem_write_byte(mem, 0xFF40, 0x80 | 0x08 | 0x01);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[2 * 160], 0x555555FFu);
+
+    /* BGP maps color 2 to shade 0 */
+    mem_write_byte(mem, 0xFF47, 0xC4);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[3 * 160], 0xFFFFFFFFu);
+
+    /* Window from line 4, x 16, map 9800 row 0 with unsigned tiles */
+    mem_write_byte(mem, 0xFF47, 0xE4);
+    mem_write_byte(mem, 0xFF4A, 4);
+    mem_write_byte(mem, 0xFF4B, 7 + 16);
+    mem_write_byte(mem, 0xFF40, 0x80 | 0x20 | 0x10 | 0x08 | 0x01);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[4 * 160 + 15], 0xFFFFFFFFu);
+    EXPECT_EQ(frame[4 * 160 + 16], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[4 * 160 + 24], 0xFFFFFFFFu);
+    EXPECT_EQ(ppu.win_line, 1);
+
+    /* LCD off: LY 0, mode 0, white screen, frames still counted */
+    mem_write_byte(mem, 0xFF40, 0x00);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 0);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_HBLANK);
+    EXPECT_EQ(frame[4 * 160 + 16], 0xFFFFFFFFu);
+    const uint64_t frames = ppu.frames;
+    ppu_step(&ppu, 154 * CYCLES_PER_LINE, mem);
+    EXPECT_EQ(ppu.frames, frames + 1);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF44), 0);
+
+    /* And back on at line 0, mode 2 */
+    mem_write_byte(mem, 0xFF40, 0x91);
+    EXPECT_EQ(mem_read_byte(mem, 0xFF41) & 0x03, PPU_MODE_OAM);
+    EXPECT_EQ(ppu_cycles_to_event(&ppu), 20);
+
+    mem_reset(mem);
+}
+
+static void set_obj(mem_t *mem, int i, int y, int x, uint8_t tile, uint8_t attr)
+{
+    mem_write_byte(mem, 0xFE00 + i * 4, y + 16);
+    mem_write_byte(mem, 0xFE01 + i * 4, x + 8);
+    mem_write_byte(mem, 0xFE02 + i * 4, tile);
+    mem_write_byte(mem, 0xFE03 + i * 4, attr);
+}
+
+TEST(ppu_sprites, ppu)
+{
+    static uint8_t rom_image[ROM_SIZE];
+    static uint32_t frame[160 * 144];
+    static ppu_t ppu;
+
+    mem_t *mem = mem_create(rom_image, ROM_SIZE);
+    ppu_init(&ppu, frame, mem);
+
+    /* Tile 1: color 1, tile 2: color 3 in the left half only,
+       tile 3: color 2 in rows 0-3 only, BG tile 4: color 3 */
+    for (int r = 0; r < 8; ++r) {
+        mem_write_byte(mem, 0x8010 + r * 2, 0xFF);
+        mem_write_byte(mem, 0x8020 + r * 2, 0xF0);
+        mem_write_byte(mem, 0x8021 + r * 2, 0xF0);
+        mem_write_byte(mem, 0x8031 + r * 2, (r < 4) ? 0xFF : 0x00);
+        mem_write_byte(mem, 0x8040 + r * 2, 0xFF);
+        mem_write_byte(mem, 0x8041 + r * 2, 0xFF);
+    }
+    mem_write_byte(mem, 0xFF47, 0xE4);
+    mem_write_byte(mem, 0xFF48, 0xE4);
+    mem_write_byte(mem, 0xFF49, 0x1B);          // reversed
+    mem_write_byte(mem, 0x9801, 0x04);          // BG color 3 at x 8..15
+    mem_write_byte(mem, 0xFF40, 0x91 | 0x02);
+
+    set_obj(mem, 0, 0, 0, 1, 0);
+    set_obj(mem, 1, 0, 20, 2, 0x20);            // X flip: opaque at 24..27
+    set_obj(mem, 2, 0, 40, 1, 0x10);            // OBP1: color 1 -> shade 2
+    set_obj(mem, 3, 0, 8, 1, 0x80);             // behind BG color 3
+    set_obj(mem, 4, 0, 56, 2, 0);               // X 56 ...
+    set_obj(mem, 5, 0, 52, 1, 0);               // ... loses to lower X 52
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(ppu.n_objs, 6);
+    EXPECT_EQ(ppu.objs[0], 0);
+    EXPECT_EQ(ppu.objs[5], 4);
+    EXPECT_EQ(frame[0], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[8], 0x000000FFu);           // BG wins over the BEHIND sprite
+    EXPECT_EQ(frame[23], 0xFFFFFFFFu);
+    EXPECT_EQ(frame[24], 0x000000FFu);
+    EXPECT_EQ(frame[27], 0x000000FFu);
+    EXPECT_EQ(frame[28], 0xFFFFFFFFu);
+    EXPECT_EQ(frame[40], 0x555555FFu);
+    EXPECT_EQ(frame[56], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[60], 0xFFFFFFFFu);          // transparent, empty BG
+
+    /* OBJ off in LCDC hides them all */
+    mem_write_byte(mem, 0xFF40, 0x91);
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(frame[160], 0xFFFFFFFFu);
+    mem_write_byte(mem, 0xFF40, 0x91 | 0x02);
+
+    /* At most 10 per line, in OAM order */
+    for (int i = 0; i < 12; ++i) {
+        set_obj(mem, i, 2, i * 8, 1, 0);
+    }
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(ppu.n_objs, 10);
+    EXPECT_EQ(frame[2 * 160 + 72], 0xAAAAAAFFu);
+    EXPECT_EQ(frame[2 * 160 + 80], 0xFFFFFFFFu);
+
+    /* 8x16: tile number bit 0 is ignored, Y flip swaps the two tiles */
+    mem_write_byte(mem, 0xFF40, 0x91 | 0x02 | 0x04);
+    for (int i = 0; i < 12; ++i) {
+        set_obj(mem, i, -20, 0, 0, 0);
+    }
+    set_obj(mem, 0, -8, 0, 0x02, 0);            // row 11: tile 3 row 3
+    set_obj(mem, 1, -9, 8, 0x03, 0x40);         // row 12 flipped: tile 2 row 3
+    ppu_step(&ppu, CYCLES_PER_LINE, mem);
+    EXPECT_EQ(ppu.n_objs, 2);
+    EXPECT_EQ(frame[3 * 160], 0x555555FFu);
+    EXPECT_EQ(frame[3 * 160 + 8], 0x000000FFu);
+
+    mem_reset(mem);
+}
+
+TEST(ppu_simd_kernels_match, ppu)
+{
+    static const uint32_t pal[4] = {0x11223344, 0x55667788, 0x99AABBCC, 0xDDEEFF00};
+    const ppu_kernels_t *ref = ppu_kernels_variant(0);
+    uint8_t data[16];
+    uint8_t idx[160];
+
+    EXPECT_TRUE(ref != NULL);
+    EXPECT_TRUE(ppu_kernels_best() != NULL);
+    srand(1234);
+    for (int i = 0; i < 160; ++i) {
+        idx[i] = (uint8_t)rand();               // upper bits must be ignored
+    }
+
+    for (int n = 1; n < ppu_kernels_count(); ++n) {
+        const ppu_kernels_t *k = ppu_kernels_variant(n);
+        if (!k) {
+            continue;
+        }
+        for (int t = 0; t < 256; ++t) {
+            uint8_t px[64], flipped[64], ref_px[64], ref_flipped[64];
+            for (int i = 0; i < 16; ++i) {
+                data[i] = (uint8_t)rand();
+            }
+            ref->decode_tile(data, ref_px, ref_flipped);
+            k->decode_tile(data, px, flipped);
+            EXPECT_EQ(memcmp(px, ref_px, 64), 0);
+            EXPECT_EQ(memcmp(flipped, ref_flipped, 64), 0);
+        }
+
+        uint32_t out[160], ref_out[160];
+        ref->expand(idx, pal, ref_out, 160);
+        k->expand(idx, pal, out, 160);
+        EXPECT_EQ(memcmp(out, ref_out, sizeof(out)), 0);
+    }
+}
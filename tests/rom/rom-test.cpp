@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ctest.h"
+#include "rom.h"
+#include "sav.h"
+
+TEST(rom_map_shared_image, rom_map)
+{
+    char path[] = "/tmp/boyc-rom-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        GTEST_SKIP();
+    }
+
+    /* 48K, not a power of two: the mapping must keep the exact size */
+    const size_t size = 48 * 1024;
+    uint8_t *image = (uint8_t *)malloc(size);
+    for (size_t i = 0; i < size; ++i) {
+        image[i] = (uint8_t)(i * 7);
+    }
+    EXPECT_EQ(write(fd, image, size), (ssize_t)size);
+    close(fd);
+
+    rom_t a;
+    rom_t b;
+    EXPECT_EQ(rom_map(path, &a), 0);
+    EXPECT_EQ(rom_map(path, &b), 0);
+    EXPECT_EQ(a.size, size);
+    EXPECT_EQ(a.mapped, 1);
+    EXPECT_EQ(a.data[0x4001], image[0x4001]);
+    EXPECT_EQ(b.data[size - 1], image[size - 1]);
+
+    rom_unmap(&a);
+    EXPECT_TRUE(a.data == NULL);
+    EXPECT_EQ(b.data[0x0100], image[0x0100]);   /* other instances keep their view */
+    rom_unmap(&b);
+
+    unlink(path);
+    free(image);
+
+    rom_t missing;
+    EXPECT_EQ(rom_map("/nonexistent/boyc.gb", &missing), -1);
+    EXPECT_TRUE(missing.data == NULL);
+}
+
+/* Minimal image with a valid header for the given cartridge type */
+static void make_header(uint8_t *rom, size_t size, uint8_t type, uint8_t ram_code)
+{
+    memcpy(&rom[0x0134], "BOYCTEST", 8);
+    rom[0x0147] = type;
+    rom[0x0148] = 0x01;     // 64K
+    rom[0x0149] = ram_code;
+
+    uint8_t x = 0;
+    for (int i = 0x0134; i <= 0x014C; ++i) {
+        x = x - rom[i] - 1;
+    }
+    rom[0x014D] = x;
+
+    uint16_t sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        sum += rom[i];
+    }
+    rom[0x014E] = sum >> 8;
+    rom[0x014F] = sum & 0xFF;
+}
+
+TEST(rom_parse_header_checksums, rom_header)
+{
+    static uint8_t rom[64 * 1024];
+    rom_header_t h;
+
+    make_header(rom, sizeof(rom), 0x10, 0x03);   // MBC3+TIMER+RAM+BATTERY, 32K
+    EXPECT_EQ(rom_parse_header(rom, sizeof(rom), &h), 0);
+    EXPECT_EQ(strcmp(h.title, "BOYCTEST"), 0);
+    EXPECT_EQ(h.rom_size, sizeof(rom));
+    EXPECT_EQ(h.header_ok, 1);
+    EXPECT_EQ(h.global_ok, 1);
+    EXPECT_EQ(h.supported, 1);
+    EXPECT_EQ(h.cart.mbc_type, MEM_MBC3);
+    EXPECT_EQ(h.cart.rtc, 1);
+    EXPECT_EQ(h.cart.battery, 1);
+    EXPECT_EQ(h.cart.ram_size, 32 * 1024);
+
+    rom[0x0200] ^= 0xFF;                      // global checksum only
+    EXPECT_EQ(rom_parse_header(rom, sizeof(rom), &h), 0);
+    EXPECT_EQ(h.header_ok, 1);
+    EXPECT_EQ(h.global_ok, 0);
+
+    rom[0x0140] ^= 0xFF;                      // inside the header
+    EXPECT_EQ(rom_parse_header(rom, sizeof(rom), &h), 0);
+    EXPECT_EQ(h.header_ok, 0);
+
+    EXPECT_EQ(rom_parse_header(rom, 0x0100, &h), -1);
+}
+
+TEST(rom_db_overrides, rom_header)
+{
+    static uint8_t image[64 * 1024];
+    char path[] = "/tmp/boyc-romdb-XXXXXX";
+    rom_header_t h;
+
+    make_header(image, sizeof(image), 0x01, 0x00);  // MBC1 without RAM
+    const rom_t rom = {image, sizeof(image), 0};
+    EXPECT_EQ(rom_crc32((const uint8_t *)"123456789", 9), 0xCBF43926u);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        GTEST_SKIP();
+    }
+    FILE *f = fdopen(fd, "w");
+    fprintf(f, "# crc32   type  ram_kb\n");
+    fprintf(f, "deadbeef  0x19  -\n");
+    fprintf(f, "%08x  -     8      BOYCTEST\n", rom_crc32(image, sizeof(image)));
+    fprintf(f, "broken line\n");
+    fclose(f);
+
+    rom_db_t *db = rom_db_load(path);
+    EXPECT_TRUE(db != NULL);
+    EXPECT_EQ(rom_parse_header(image, sizeof(image), &h), 0);
+    EXPECT_EQ(h.cart.ram_size, 0);
+    EXPECT_EQ(rom_db_apply(db, &rom, &h), 1);
+    EXPECT_EQ(h.cart.mbc_type, MEM_MBC1);
+    EXPECT_EQ(h.cart.ram_size, 8 * 1024);
+
+    image[0x7FFF] = 1;                             // no longer in the database
+    EXPECT_EQ(rom_parse_header(image, sizeof(image), &h), 0);
+    EXPECT_EQ(rom_db_apply(db, &rom, &h), 0);
+
+    rom_db_free(db);
+    unlink(path);
+}
+
+TEST(sav_mmap_persists, sav)
+{
+    static uint8_t image[64 * 1024];
+    char path[] = "/tmp/boyc-sav-XXXXXX";
+    char sav_path[64];
+    rom_header_t h;
+    sav_t sav;
+
+    sav_path_for("dir.v1/game.gb", sav_path, sizeof(sav_path));
+    EXPECT_EQ(strcmp(sav_path, "dir.v1/game.sav"), 0);
+    sav_path_for("game", sav_path, sizeof(sav_path));
+    EXPECT_EQ(strcmp(sav_path, "game.sav"), 0);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        GTEST_SKIP();
+    }
+    close(fd);
+
+    make_header(image, sizeof(image), 0x03, 0x02);  // MBC1+RAM+BATTERY, 8K
+    EXPECT_EQ(rom_parse_header(image, sizeof(image), &h), 0);
+    EXPECT_EQ(h.cart.battery, 1);
+    EXPECT_EQ(sav_open(path, h.cart.ram_size, &sav), 0);
+    sav_set_policy(&sav, SAV_SYNC_DIRTY, 0);
+    h.cart.ram = sav.data;
+
+    mem_t *mem = mem_create_cart(image, sizeof(image), &h.cart);
+    EXPECT_EQ(sav_tick(&sav, mem, 0), 0);      // nothing written yet
+    mem_write_byte(mem, 0x0000, 0x0A);          // enable RAM
+    mem_write_byte(mem, 0xA123, 0x5A);
+    mem_write_byte(mem, 0xBFFF, 0xA5);
+    EXPECT_EQ(sav.data[0x0123], 0x5A);
+    EXPECT_EQ(sav_tick(&sav, mem, 1), 1);
+    EXPECT_EQ(sav_tick(&sav, mem, 2), 0);      // clean again until the next write
+    mem_write_byte(mem, 0xA000, 0x01);
+    EXPECT_EQ(mem_eram_dirty(mem), 1);
+    EXPECT_EQ(mem_eram_dirty(mem), 0);
+    EXPECT_EQ(sav.syncs, 1u);
+    mem_reset(mem);
+    sav_close(&sav);
+
+    EXPECT_EQ(sav_open(path, h.cart.ram_size, &sav), 0);
+    EXPECT_EQ(sav.data[0x0000], 0x01);
+    EXPECT_EQ(sav.data[0x0123], 0x5A);
+    EXPECT_EQ(sav.data[0x1FFF], 0xA5);
+    sav_close(&sav);
+    unlink(path);
+}
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+/**
+ * Build-time generator for the cpu dispatch code.
+ *
+ * Reads doc/opcodes.json and writes cpu_ops_gen.h with
+ *  - specialized handlers for the regular opcode families (8-bit loads,
+ *    8-bit ALU, INC/DEC, 16-bit loads/INC/DEC, PUSH/POP),
+ *  - CPU_OP_LIST(X), the opcode -> handler list for all 256 opcodes,
+ *  - the op_cycles and op_length tables.
+ *
+ * Handler names follow the mnemonic: "LD B, (HL)" -> op_ld_b_mhl,
+ * "LD (HL+), A" -> op_ld_mhli_a, "RST 7" -> op_rst_7. Opcodes outside the
+ * generated families are expected to be written by hand in cpu_ops.h under
+ * that name.
+ *
+ * usage: gen_ops <opcodes.json> <cpu_ops_gen.h>
+ */
+
+typedef struct {
+    std::string mnemonic;
+    int opcode = -1;
+    int bytes = 0;
+    std::string cycles;
+} op_desc_t;
+
+/* Minimal JSON reader, just enough for doc/opcodes.json */
+typedef struct {
+    const char *p;
+    int error;
+} json_t;
+
+static void json_ws(json_t *j)
+{
+    while (*j->p && isspace((unsigned char)*j->p)) {
+        j->p++;
+    }
+}
+
+static int json_expect(json_t *j, char c)
+{
+    json_ws(j);
+    if (*j->p != c) {
+        j->error = 1;
+        return 0;
+    }
+    j->p++;
+    return 1;
+}
+
+static std::string json_string(json_t *j)
+{
+    std::string s;
+
+    if (!json_expect(j, '"')) {
+        return s;
+    }
+    while (*j->p && *j->p != '"') {
+        if (*j->p == '\\' && j->p[1]) {
+            j->p++;
+            switch (*j->p) {
+                case 'n': s += '\n'; break;
+                case 't': s += '\t'; break;
+                default:  s += *j->p; break;
+            }
+        } else {
+            s += *j->p;
+        }
+        j->p++;
+    }
+    json_expect(j, '"');
+    return s;
+}
+
+static void json_skip_value(json_t *j);
+
+static void json_skip_object(json_t *j)
+{
+    json_expect(j, '{');
+    json_ws(j);
+    while (!j->error && *j->p != '}') {
+        json_string(j);
+        json_expect(j, ':');
+        json_skip_value(j);
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            json_ws(j);
+        }
+    }
+    json_expect(j, '}');
+}
+
+static void json_skip_value(json_t *j)
+{
+    json_ws(j);
+    if (*j->p == '"') {
+        json_string(j);
+    } else if (*j->p == '{') {
+        json_skip_object(j);
+    } else {
+        while (*j->p && *j->p != ',' && *j->p != '}' && *j->p != ']') {
+            j->p++;
+        }
+    }
+}
+
+static int parse_opcodes(const char *text, std::vector<op_desc_t> &out)
+{
+    json_t j = { text, 0 };
+
+    json_expect(&j, '[');
+    json_ws(&j);
+    while (!j.error && *j.p != ']') {
+        op_desc_t d;
+
+        json_expect(&j, '{');
+        json_ws(&j);
+        while (!j.error && *j.p != '}') {
+            std::string key = json_string(&j);
+            json_expect(&j, ':');
+            json_ws(&j);
+            if (key == "mnemonic") {
+                d.mnemonic = json_string(&j);
+            } else if (key == "opCode") {
+                std::string code = json_string(&j);
+                /* CB-prefixed opcodes ("CB40") are handled in cpu.cpp */
+                d.opcode = (code.size() == 2) ? (int)strtol(code.c_str(), NULL, 16) : -1;
+            } else if (key == "cycles") {
+                d.cycles = json_string(&j);
+            } else if (key == "bytes") {
+                d.bytes = (int)strtol(j.p, (char **)&j.p, 10);
+            } else {
+                json_skip_value(&j);
+            }
+            json_ws(&j);
+            if (*j.p == ',') {
+                j.p++;
+                json_ws(&j);
+            }
+        }
+        json_expect(&j, '}');
+        json_ws(&j);
+        if (*j.p == ',') {
+            j.p++;
+            json_ws(&j);
+        }
+        if (d.opcode >= 0) {
+            out.push_back(d);
+        }
+    }
+    return j.error ? -1 : 0;
+}
+
+/* "LD A, (HL+)" -> {"LD", "A", "(HL+)"} */
+static std::vector<std::string> split_mnemonic(const std::string &mn)
+{
+    std::vector<std::string> parts;
+    std::string cur;
+
+    for (char c : mn) {
+        if (c == ' ' || c == ',') {
+            if (!cur.empty()) {
+                parts.push_back(cur);
+            }
+            cur.clear();
+        } else {
+            cur += c;
+        }
+    }
+    if (!cur.empty()) {
+        parts.push_back(cur);
+    }
+    return parts;
+}
+
+static std::string handler_name(const std::string &mn)
+{
+    std::string name = "op";
+
+    for (std::string part : split_mnemonic(mn)) {
+        std::string s;
+        if (part[0] == '(') {           /* memory operand */
+            s = "m";
+            for (char c : part) {
+                if (c == '+') s += 'i';
+                else if (c == '-') s += 'd';
+                else if (c != '(' && c != ')') s += (char)tolower((unsigned char)c);
+            }
+        } else {
+            for (char c : part) {
+                s += (c == '+') ? '_' : (char)tolower((unsigned char)c);
+            }
+        }
+        name += "_" + s;
+    }
+    return name;
+}
+
+/* Instruction length from the operands; the JSON has a few wrong entries
+ * (LD (HL), d8 is listed as one byte) */
+static int operand_length(const op_desc_t &d)
+{
+    int len = 1;
+
+    for (const std::string &part : split_mnemonic(d.mnemonic)) {
+        if (part.find("d16") != std::string::npos || part.find("a16") != std::string::npos) {
+            len = 3;
+        } else if (len < 2 && (part.find("d8") != std::string::npos ||
+                               part.find("a8") != std::string::npos ||
+                               part.find("s8") != std::string::npos)) {
+            len = 2;
+        }
+    }
+    return (d.bytes > len) ? d.bytes : len;
+}
+
+/* Not-taken count for branches ("3/2" -> 2) */
+static int base_cycles(const op_desc_t &d)
+{
+    size_t slash = d.cycles.find('/');
+    return atoi(d.cycles.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+}
+
+static int is_reg8(const std::string &s)
+{
+    return s.size() == 1 && strchr("ABCDEHL", s[0]) != NULL;
+}
+
+static int is_reg16(const std::string &s)
+{
+    return s == "BC" || s == "DE" || s == "HL" || s == "SP";
+}
+
+static std::string lower(const std::string &s)
+{
+    std::string r;
+    for (char c : s) {
+        r += (char)tolower((unsigned char)c);
+    }
+    return r;
+}
+
+static std::string reg16_lvalue(const std::string &s)
+{
+    return (s == "SP") ? "cpu->sp" : "cpu->r." + lower(s);
+}
+
+/* Expression reading an 8-bit source operand, empty if not one */
+static std::string src8(const std::string &s)
+{
+    if (is_reg8(s)) return "cpu->r." + lower(s);
+    if (s == "(HL)") return "mem_read_byte(m, cpu->r.hl)";
+    if (s == "d8") return "cpu_imm8(cpu)";
+    return "";
+}
+
+/* Statement(s) of a generated handler without the pc/cycle epilogue, empty
+ * for opcodes that are hand-written */
+static std::string family_body(const op_desc_t &d)
+{
+    std::vector<std::string> p = split_mnemonic(d.mnemonic);
+    const std::string &op = p[0];
+
+    if (op == "LD" && p.size() == 3) {
+        const std::string &dst = p[1];
+        std::string src = src8(p[2]);
+        if (src.empty()) {
+            if (is_reg16(dst) && p[2] == "d16") {
+                return "    " + reg16_lvalue(dst) + " = cpu_imm16(cpu);\n";
+            }
+            return "";
+        }
+        if (is_reg8(dst)) {
+            return "    cpu->r." + lower(dst) + " = " + src + ";\n";
+        }
+        if (dst == "(HL)" && p[2] != "(HL)") {
+            return "    mem_write_byte(m, cpu->r.hl, " + src + ");\n";
+        }
+        return "";
+    }
+
+    /* 8-bit ALU: "ADD A, x", "ADC A, x", "SBC A, x", "SUB x", "AND x", ... */
+    static const char *const alu[] = { "ADD", "ADC", "SUB", "SBC", "AND", "XOR", "OR", "CP" };
+    for (const char *name : alu) {
+        if (op != name) {
+            continue;
+        }
+        std::string operand = p.back();
+        if ((p.size() == 3 && p[1] != "A") || p.size() < 2 || p.size() > 3) {
+            return "";
+        }
+        std::string src = src8(operand);
+        if (src.empty()) {
+            return "";
+        }
+        return "    alu_" + lower(op) + "(cpu, " + src + ");\n";
+    }
+
+    if ((op == "INC" || op == "DEC") && p.size() == 2) {
+        std::string fn = (op == "INC") ? "inc8" : "dec8";
+        if (is_reg8(p[1])) {
+            std::string r = "cpu->r." + lower(p[1]);
+            return "    " + r + " = " + fn + "(cpu, " + r + ");\n";
+        }
+        if (p[1] == "(HL)") {
+            return "    mem_write_byte(m, cpu->r.hl, " + fn +
+                   "(cpu, mem_read_byte(m, cpu->r.hl)));\n";
+        }
+        if (is_reg16(p[1])) {
+            return "    " + reg16_lvalue(p[1]) + (op == "INC" ? "++" : "--") + ";\n";
+        }
+        return "";
+    }
+
+    if ((op == "PUSH" || op == "POP") && p.size() == 2 && p[1] != "AF") {
+        if (op == "PUSH") {
+            return "    push_word(cpu, m, cpu->r." + lower(p[1]) + ");\n";
+        }
+        return "    cpu->r." + lower(p[1]) + " = pop_word(cpu, m);\n";
+    }
+    return "";
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = (char *)malloc(size + 1);
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) {
+        buf[size] = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+static void write_table(FILE *out, const char *name, const int *values)
+{
+    fprintf(out, "static const uint8_t %s[OPS_COUNT] = {\n", name);
+    for (int row = 0; row < 16; ++row) {
+        fprintf(out, "   ");
+        for (int col = 0; col < 16; ++col) {
+            fprintf(out, " %d,", values[row * 16 + col]);
+        }
+        fprintf(out, " /* %X0 */\n", row);
+    }
+    fprintf(out, "};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <opcodes.json> <cpu_ops_gen.h>\n", argv[0]);
+        return 1;
+    }
+
+    char *text = read_file(argv[1]);
+    if (!text) {
+        fprintf(stderr, "gen_ops: cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<op_desc_t> ops;
+    if (parse_opcodes(text, ops) != 0) {
+        fprintf(stderr, "gen_ops: %s is not valid JSON\n", argv[1]);
+        free(text);
+        return 1;
+    }
+    free(text);
+
+    const op_desc_t *by_code[256] = {};
+    for (const op_desc_t &d : ops) {
+        by_code[d.opcode] = &d;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "gen_ops: cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out,
+            "/* Generated from doc/opcodes.json by tools/gen_ops.cpp, do not edit */\n"
+            "#ifndef CPU_OPS_GEN_H\n"
+            "#define CPU_OPS_GEN_H\n\n");
+
+    int generated = 0;
+    for (int code = 0; code < 256; ++code) {
+        const op_desc_t *d = by_code[code];
+        if (!d) {
+            continue;
+        }
+        std::string body = family_body(*d);
+        if (body.empty()) {
+            continue;
+        }
+        fprintf(out,
+                "/* %s (opcode 0x%02X) */\n"
+                "static inline uint8_t %s(cpu_t *cpu, mem_t *m) {\n"
+                "%s"
+                "    cpu->pc += %d;\n"
+                "    return %d;\n"
+                "}\n\n",
+                d->mnemonic.c_str(), code, handler_name(d->mnemonic).c_str(),
+                body.c_str(), operand_length(*d), base_cycles(*d));
+        generated++;
+    }
+
+    fprintf(out,
+            "/* All 256 base opcodes in opcode order, X(opcode, handler).\n"
+            " * Unused opcodes (0xD3, 0xDB, ...) map to op_illegal. */\n"
+            "#define CPU_OP_LIST(X) \\\n");
+    for (int code = 0; code < 256; ++code) {
+        const op_desc_t *d = by_code[code];
+        std::string name = (code == 0xCB) ? "op_prefix_cb"
+                         : d ? handler_name(d->mnemonic) : "op_illegal";
+        fprintf(out, "    X(0x%02X, %s)%s\n", code, name.c_str(), code == 255 ? "" : " \\");
+    }
+    fprintf(out, "\n");
+
+    int cycles[256];
+    int length[256];
+    for (int code = 0; code < 256; ++code) {
+        const op_desc_t *d = by_code[code];
+        cycles[code] = d ? base_cycles(*d) : 1;
+        length[code] = d ? operand_length(*d) : 1;
+    }
+    cycles[0xCB] = 2;   /* prefix, the CB handler returns the real count */
+    length[0xCB] = 2;
+
+    fprintf(out,
+            "/* Documented machine cycles, branches list the not-taken count.\n"
+            " * The handlers return the actual count. */\n");
+    write_table(out, "op_cycles", cycles);
+    fprintf(out, "/* Instruction length in bytes including the opcode */\n");
+    write_table(out, "op_length", length);
+
+    fprintf(out, "#endif  // CPU_OPS_GEN_H\n");
+    fclose(out);
+
+    printf("gen_ops: %d opcodes, %d generated handlers\n", (int)ops.size(), generated);
+    return 0;
+}
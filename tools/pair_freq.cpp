@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "cpu.h"
+#include "cpu_ops.h"
+#include "mem.h"
+#include "rom.h"
+#include "ppu.h"
+
+/**
+ * Offline helper to choose the superinstruction set (CPU_FUSE_LIST in
+ * cpu.cpp).
+ *
+ * Runs a ROM headless (cpu + ppu, like boyc_exec) and traces every pair of
+ * instructions where the second directly follows the first on the same
+ * 256 byte ROM page, i.e. the pairs the decoded-instruction cache could
+ * fuse. Prints the most frequent ones as CPU_FUSE_LIST lines, pairs whose
+ * first op branches or writes memory are listed as comments only.
+ *
+ * usage: pair_freq <rom file> [instructions] [top]
+ */
+
+#define OP_NAME(opcode, fn) #fn,
+
+static const char *const op_names[OPS_COUNT] = {
+    CPU_OP_LIST(OP_NAME)
+};
+
+typedef struct {
+    uint64_t count;
+    uint16_t pair;
+} pair_count_t;
+
+static int starts_with(const char *s, const char *prefix)
+{
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* First op of a fused pair has to fall through and must not write memory */
+static int can_lead(uint8_t opcode)
+{
+    static const char *const excluded[] = {
+        "op_jp", "op_jr", "op_call", "op_ret", "op_rst", "op_halt", "op_stop",
+        "op_prefix_cb", "op_push", "op_ld_m", "op_inc_mhl", "op_dec_mhl",
+    };
+    const char *name = op_names[opcode];
+
+    for (size_t i = 0; i < sizeof(excluded) / sizeof(excluded[0]); ++i) {
+        if (starts_with(name, excluded[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <rom file> [instructions] [top]\n", argv[0]);
+        return 1;
+    }
+
+    const long steps = (argc > 2) ? atol(argv[2]) : 10000000L;
+    const int top = (argc > 3) ? atoi(argv[3]) : 16;
+
+    rom_t cart;
+    if (rom_map(argv[1], &cart) != 0) {
+        return 1;
+    }
+
+    rom_header_t header;
+    if (rom_parse_header(cart.data, cart.size, &header) != 0) {
+        fprintf(stderr, "pair_freq: %s has no cartridge header\n", argv[1]);
+        rom_unmap(&cart);
+        return 1;
+    }
+
+    mem_t *mem = mem_create_cart(cart.data, cart.size, &header.cart);
+    cpu_t cpu;
+    ppu_t ppu;
+    static uint32_t frame[160 * 144];
+
+    cpu_reset(&cpu);
+    ppu_init(&ppu, frame, mem);
+
+    std::vector<uint64_t> counts(OPS_COUNT * OPS_COUNT, 0);
+    uint64_t total = 0;
+    int prev = -1;          /* opcode at prev_next, -1 if none */
+    uint16_t prev_next = 0; /* fall-through address of the previous op */
+
+    for (long i = 0; i < steps; ++i) {
+        const uint16_t pc = cpu.pc;
+        const uint8_t opcode = mem_read_byte(mem, pc);
+        const uint64_t start_cycles = cpu.cycles;
+
+        cpu.event_at = cpu.cycles + ppu_cycles_to_event(&ppu);
+        cpu_step(&cpu, mem);
+        ppu_step(&ppu, cpu.cycles - start_cycles, mem);
+        mem_step(mem, (uint32_t)(cpu.cycles - start_cycles));
+
+        if (prev >= 0 && pc == prev_next) {
+            counts[(prev << 8) | opcode]++;
+            total++;
+        }
+
+        /* Next pair starts here if this op fell through on the same page */
+        const uint16_t next = pc + op_length[opcode];
+        if (pc < 0x8000 && cpu.pc == next && (next >> 8) == (pc >> 8)) {
+            prev = opcode;
+            prev_next = next;
+        } else {
+            prev = -1;
+        }
+    }
+
+    std::vector<pair_count_t> pairs;
+    for (int p = 0; p < OPS_COUNT * OPS_COUNT; ++p) {
+        if (counts[p]) {
+            pairs.push_back({counts[p], (uint16_t)p});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const pair_count_t &a, const pair_count_t &b) {
+        return a.count > b.count;
+    });
+
+    printf("/* %s: %ld instructions, %llu fusable pairs */\n", argv[1], steps,
+           (unsigned long long)total);
+    int n = 0;
+    for (size_t i = 0; i < pairs.size() && (int)i < top; ++i) {
+        const uint8_t first = pairs[i].pair >> 8;
+        const uint8_t second = pairs[i].pair & 0xFF;
+        const double share = 100.0 * pairs[i].count / total;
+
+        if (can_lead(first)) {
+            printf("    X(%d, 0x%02X, 0x%02X, %s, %s)  /* %5.2f%% */ \\\n",
+                   n++, first, second, op_names[first], op_names[second], share);
+        } else {
+            printf("    /* 0x%02X, 0x%02X, %s, %s  %5.2f%%, first op not fusable */ \\\n",
+                   first, second, op_names[first], op_names[second], share);
+        }
+    }
+
+    ppu_reset(&ppu);
+    mem_reset(mem);
+    rom_unmap(&cart);
+    return 0;
+}